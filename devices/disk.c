@@ -3,13 +3,30 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].  When the
+   controller is a PCI bus-master IDE controller, such as the PIIX
+   that QEMU emulates, sectors are moved by DMA; otherwise, and for
+   buffers that DMA cannot reach, by programmed I/O.
+
+   Each channel has a driver thread that owns the controller.  It
+   serves the requests queued for the channel's disks in elevator
+   (C-LOOK) order, sweeping up through the sectors and then starting
+   over from the lowest one, so that scattered requests cost less
+   seeking.  A request that has waited DEADLINE_TICKS is served next
+   regardless, so none starves.  Requests for the sectors right
+   after the one being served, in the same direction, are merged
+   into the same command. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -32,6 +49,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -47,6 +65,42 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Bus-master IDE registers, at an I/O base given by BAR 4 of the
+   controller, 8 ports per channel. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus-master Command Register bits. */
+#define BMC_START 0x01          /* Start transfer. */
+#define BMC_READ 0x08           /* Direction: disk to memory. */
+
+/* Bus-master Status Register bits.  Writing 1 to ERROR or INTR
+   clears it. */
+#define BMS_ERROR 0x02          /* Transfer failed. */
+#define BMS_INTR 0x04           /* Disk raised its interrupt. */
+
+/* A physical region descriptor: one physically contiguous piece
+   of a DMA buffer, which must not cross a 64 kB boundary.  A
+   channel's PRD table lists the pieces of the current transfer. */
+struct prd {
+	uint32_t addr;              /* Physical address. */
+	uint16_t size;              /* Size in bytes, 0 meaning 64 kB. */
+	uint16_t flags;             /* PRD_EOT in the last entry. */
+};
+#define PRD_EOT 0x8000          /* End of table. */
+#define PRD_BOUNDARY 0x10000    /* A PRD may not cross this boundary. */
+
+/* Request scheduling. */
+#define DEADLINE_TICKS (TIMER_FREQ / 2) /* Longest wait before priority. */
+#define MERGE_MAX 64            /* Most requests merged in a command. */
+
+/* Most sectors one command can transfer.  A Sector Count of 0
+   stands for this many. */
+#define MAX_SECTORS_PER_CMD 256
 
 /* An ATA device. */
 struct disk {
@@ -57,6 +111,8 @@ struct disk {
 	bool is_ata;                /* 1=This device is an ATA disk. */
 	disk_sector_t capacity;     /* Capacity in sectors (if is_ata). */
 
+	bool dma;                   /* Supports DMA on a bus-master channel? */
+
 	long long read_cnt;         /* Number of sectors read. */
 	long long write_cnt;        /* Number of sectors written. */
 };
@@ -68,11 +124,24 @@ struct channel {
 	uint16_t reg_base;          /* Base I/O port. */
 	uint8_t irq;                /* Interrupt in use. */
 
-	struct lock lock;           /* Must acquire to access the controller. */
+	struct lock lock;           /* Protects the request queues. */
+	struct condition queued;    /* Signaled when a request is queued. */
+	struct list queue;          /* Requests, by device and sector. */
+	struct list fifo;           /* Requests, oldest first. */
+	int head_dev;               /* Device last served. */
+	disk_sector_t head;         /* Sector after the last one served. */
+
 	bool expecting_interrupt;   /* True if an interrupt is expected, false if
 								   any interrupt would be spurious. */
 	struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+	uint16_t bm_base;           /* Bus-master I/O base, or 0 if none. */
+	struct prd *prdt;           /* PRD table, if BM_BASE is nonzero. */
+
+	/* Bounce buffer for user buffers when no page is free. */
+	struct lock bounce_lock;    /* Protects BOUNCE. */
+	uint8_t bounce[DISK_SECTOR_SIZE];
+
 	struct disk devices[2];     /* The devices on this channel. */
 };
 
@@ -84,10 +153,23 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
 
-static void select_sector (struct disk *, disk_sector_t);
+static void select_sector (struct disk *, disk_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
+static void pio_read (struct disk *, disk_sector_t, size_t cnt,
+		struct list *);
+static void pio_write (struct disk *, disk_sector_t, size_t cnt,
+		struct list *);
+
+static uint16_t find_bus_master (void);
+static bool dma_usable (const struct disk *, const void *, size_t cnt);
+static void dma_transfer (struct disk *, disk_sector_t, size_t cnt,
+		struct list *, bool write);
+
+static void transfer (struct disk *, disk_sector_t, size_t cnt,
+		const void *, bool write);
+static void channel_driver (void *c_) NO_RETURN;
 
 static void wait_until_idle (const struct disk *);
 static bool wait_while_busy (const struct disk *);
@@ -99,6 +181,7 @@ static void interrupt_handler (struct intr_frame *);
 /* Initialize the disk subsystem and detect disks. */
 void
 disk_init (void) {
+	uint16_t bm_base = find_bus_master ();
 	size_t chan_no;
 
 	for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) {
@@ -120,8 +203,24 @@ disk_init (void) {
 				NOT_REACHED ();
 		}
 		lock_init (&c->lock);
+		cond_init (&c->queued);
+		list_init (&c->queue);
+		list_init (&c->fifo);
+		c->head_dev = 0;
+		c->head = 0;
 		c->expecting_interrupt = false;
 		sema_init (&c->completion_wait, 0);
+		lock_init (&c->bounce_lock);
+
+		/* Set up DMA.  The PRD table must not cross a 64 kB
+		   boundary, which a page never does. */
+		c->bm_base = 0;
+		c->prdt = NULL;
+		if (bm_base != 0) {
+			c->prdt = palloc_get_page (0);
+			if (c->prdt != NULL)
+				c->bm_base = bm_base + chan_no * 8;
+		}
 
 		/* Initialize devices. */
 		for (dev_no = 0; dev_no < 2; dev_no++) {
@@ -132,6 +231,7 @@ disk_init (void) {
 
 			d->is_ata = false;
 			d->capacity = 0;
+			d->dma = false;
 
 			d->read_cnt = d->write_cnt = 0;
 		}
@@ -150,6 +250,12 @@ disk_init (void) {
 		for (dev_no = 0; dev_no < 2; dev_no++)
 			if (c->devices[dev_no].is_ata)
 				identify_ata_device (&c->devices[dev_no]);
+
+		/* Start serving requests. */
+		if ((c->devices[0].is_ata || c->devices[1].is_ata)
+				&& thread_create (c->name, PRI_MAX, channel_driver, c)
+				== TID_ERROR)
+			PANIC ("%s: cannot start driver thread", c->name);
 	}
 
 	/* DO NOT MODIFY BELOW LINES. */
@@ -209,21 +315,7 @@ disk_size (struct disk *d) {
    per-disk locking is unneeded. */
 void
 disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
-	struct channel *c;
-
-	ASSERT (d != NULL);
-	ASSERT (buffer != NULL);
-
-	c = d->channel;
-	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-	sema_down (&c->completion_wait);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-	input_sector (c, buffer);
-	d->read_cnt++;
-	lock_release (&c->lock);
+	disk_read_multiple (d, sec_no, 1, buffer);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -233,23 +325,252 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
    per-disk locking is unneeded. */
 void
 disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
-	struct channel *c;
+	disk_write_multiple (d, sec_no, 1, buffer);
+}
+
+/* Reads the CNT consecutive sectors starting at SEC_NO from disk D
+   into BUFFER, which must have room for CNT * DISK_SECTOR_SIZE
+   bytes.  Each run of up to DISK_REQUEST_MAX sectors is read with a
+   single command.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_read_multiple (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		void *buffer) {
+	transfer (d, sec_no, cnt, buffer, false);
+}
+
+/* Writes the CNT consecutive sectors starting at SEC_NO on disk D
+   from BUFFER, which must contain CNT * DISK_SECTOR_SIZE bytes.
+   Each run of up to DISK_REQUEST_MAX sectors is written with a
+   single command.  Returns after the disk has acknowledged
+   receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_write_multiple (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		const void *buffer) {
+	transfer (d, sec_no, cnt, buffer, true);
+}
+
+/* Moves CNT sectors between disk D and BUFFER as disk_read_multiple()
+   or disk_write_multiple(), according to WRITE, waiting for each
+   request to complete. */
+static void
+transfer (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		const void *buffer_, bool write) {
+	/* The buffer is only read from when WRITE is true. */
+	uint8_t *buffer = (uint8_t *) buffer_;
+	uint8_t *bounce = NULL, *page = NULL;
+	struct lock *bounce_lock = NULL;
+	size_t max = DISK_REQUEST_MAX;
 
 	ASSERT (d != NULL);
 	ASSERT (buffer != NULL);
 
-	c = d->channel;
+	/* A user buffer is mapped only in its own process, not in the
+	   driver thread, so it is copied through a kernel page, or one
+	   sector at a time through the channel's buffer if no page is
+	   free. */
+	if (!is_kernel_vaddr (buffer)) {
+		page = palloc_get_page (0);
+		if (page != NULL) {
+			bounce = page;
+			max = PGSIZE / DISK_SECTOR_SIZE;
+		} else {
+			bounce_lock = &d->channel->bounce_lock;
+			lock_acquire (bounce_lock);
+			bounce = d->channel->bounce;
+			max = 1;
+		}
+	}
+
+	while (cnt > 0) {
+		size_t run = cnt < max ? cnt : max;
+		size_t size = run * DISK_SECTOR_SIZE;
+		struct disk_request r;
+
+		if (bounce != NULL && write)
+			memcpy (bounce, buffer, size);
+		disk_request_init (&r, d, sec_no, run,
+				bounce != NULL ? bounce : buffer, write);
+		disk_submit (&r);
+		disk_wait (&r);
+		if (bounce != NULL && !write)
+			memcpy (buffer, bounce, size);
+		buffer += size;
+		sec_no += run;
+		cnt -= run;
+	}
+	palloc_free_page (page);
+	if (bounce_lock != NULL)
+		lock_release (bounce_lock);
+}
+
+/* Initializes R as a request to move CNT sectors starting at SEC_NO
+   between disk D and BUFFER: to the disk if WRITE is true, from it
+   if false.  CNT must be between 1 and DISK_REQUEST_MAX.  The
+   request has no COMPLETE function. */
+void
+disk_request_init (struct disk_request *r, struct disk *d,
+		disk_sector_t sec_no, size_t cnt, void *buffer, bool write) {
+	ASSERT (r != NULL);
+	ASSERT (d != NULL);
+	ASSERT (is_kernel_vaddr (buffer));
+	ASSERT (cnt > 0 && cnt <= DISK_REQUEST_MAX);
+
+	r->disk = d;
+	r->sec_no = sec_no;
+	r->cnt = cnt;
+	r->buffer = buffer;
+	r->write = write;
+	r->complete = NULL;
+	r->aux = NULL;
+	sema_init (&r->done, 0);
+}
+
+/* Returns true if request A comes before B in sector order. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+		void *aux UNUSED) {
+	const struct disk_request *a = list_entry (a_, struct disk_request, elem);
+	const struct disk_request *b = list_entry (b_, struct disk_request, elem);
+
+	if (a->disk != b->disk)
+		return a->disk->dev_no < b->disk->dev_no;
+	return a->sec_no < b->sec_no;
+}
+
+/* Queues request R on its disk's channel and returns without
+   waiting for it.  R completes later, in the channel's driver
+   thread. */
+void
+disk_submit (struct disk_request *r) {
+	struct channel *c = r->disk->channel;
+
+	ASSERT (!intr_context ());
+	ASSERT (r->sec_no < r->disk->capacity
+			&& r->cnt <= r->disk->capacity - r->sec_no);
+
+	r->time = timer_ticks ();
 	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-	output_sector (c, buffer);
-	sema_down (&c->completion_wait);
-	d->write_cnt++;
+	list_insert_ordered (&c->queue, &r->elem, request_less, NULL);
+	list_push_back (&c->fifo, &r->fifo_elem);
+	cond_signal (&c->queued, &c->lock);
 	lock_release (&c->lock);
 }
-
+
+/* Waits for request R, which must have no COMPLETE function, to
+   complete. */
+void
+disk_wait (struct disk_request *r) {
+	ASSERT (r->complete == NULL);
+	sema_down (&r->done);
+}
+
+/* Returns the request that channel C should serve next, which must
+   have a nonempty queue.  C's lock must be held. */
+static struct disk_request *
+next_request (struct channel *c) {
+	struct disk_request *oldest;
+	struct list_elem *e;
+
+	oldest = list_entry (list_front (&c->fifo), struct disk_request, fifo_elem);
+	if (timer_elapsed (oldest->time) >= DEADLINE_TICKS)
+		return oldest;
+
+	/* Continue the sweep from the head, or start it over. */
+	for (e = list_begin (&c->queue); e != list_end (&c->queue);
+			e = list_next (e)) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+
+		if (r->disk->dev_no > c->head_dev
+				|| (r->disk->dev_no == c->head_dev && r->sec_no >= c->head))
+			return r;
+	}
+	return list_entry (list_front (&c->queue), struct disk_request, elem);
+}
+
+/* Removes FIRST from channel C's queues, along with the requests
+   that can be merged after it, and puts them in BATCH in sector
+   order.  Returns the number of sectors in BATCH.  C's lock must be
+   held. */
+static size_t
+take_batch (struct channel *c, struct disk_request *first,
+		struct list *batch) {
+	bool dma = dma_usable (first->disk, first->buffer, first->cnt);
+	size_t cnt = first->cnt;
+	size_t merged = 1;
+	struct list_elem *e;
+
+	list_init (batch);
+	e = list_remove (&first->elem);
+	list_remove (&first->fifo_elem);
+	list_push_back (batch, &first->elem);
+
+	while (e != list_end (&c->queue) && merged < MERGE_MAX) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+
+		if (r->disk != first->disk || r->write != first->write
+				|| r->sec_no != first->sec_no + cnt
+				|| r->cnt > MAX_SECTORS_PER_CMD - cnt
+				|| dma_usable (r->disk, r->buffer, r->cnt) != dma)
+			break;
+		e = list_remove (&r->elem);
+		list_remove (&r->fifo_elem);
+		list_push_back (batch, &r->elem);
+		cnt += r->cnt;
+		merged++;
+	}
+
+	c->head_dev = first->disk->dev_no;
+	c->head = first->sec_no + cnt;
+	return cnt;
+}
+
+/* Driver thread for channel C, passed as C_.  Serves the requests
+   queued for C's disks one command at a time, and completes them. */
+static void
+channel_driver (void *c_) {
+	struct channel *c = c_;
+
+	for (;;) {
+		struct disk_request *first;
+		struct disk *d;
+		struct list batch;
+		size_t cnt;
+
+		lock_acquire (&c->lock);
+		while (list_empty (&c->queue))
+			cond_wait (&c->queued, &c->lock);
+		first = next_request (c);
+		cnt = take_batch (c, first, &batch);
+		lock_release (&c->lock);
+
+		d = first->disk;
+		if (dma_usable (d, first->buffer, first->cnt))
+			dma_transfer (d, first->sec_no, cnt, &batch, first->write);
+		else if (first->write)
+			pio_write (d, first->sec_no, cnt, &batch);
+		else
+			pio_read (d, first->sec_no, cnt, &batch);
+		if (first->write)
+			d->write_cnt += cnt;
+		else
+			d->read_cnt += cnt;
+
+		/* COMPLETE may free its request. */
+		while (!list_empty (&batch)) {
+			struct disk_request *r = list_entry (list_pop_front (&batch),
+					struct disk_request, elem);
+			if (r->complete != NULL)
+				r->complete (r);
+			else
+				sema_up (&r->done);
+		}
+	}
+}
+
 /* Disk detection and identification. */
 
 static void print_ata_string (char *string, size_t size);
@@ -364,6 +685,9 @@ identify_ata_device (struct disk *d) {
 	/* Calculate capacity. */
 	d->capacity = id[60] | ((uint32_t) id[61] << 16);
 
+	/* Word 49, bit 8: DMA supported. */
+	d->dma = c->bm_base != 0 && (id[49] & 0x100) != 0;
+
 	/* Print identification message. */
 	printf ("%s: detected %'"PRDSNu" sector (", d->name, d->capacity);
 	if (d->capacity > 1024 / DISK_SECTOR_SIZE * 1024 * 1024)
@@ -402,17 +726,19 @@ print_ata_string (char *string, size_t size) {
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the count CNT of sectors to transfer from
+   there to the disk's sector selection registers.  (We use LBA
+   mode.) */
 static void
-select_sector (struct disk *d, disk_sector_t sec_no) {
+select_sector (struct disk *d, disk_sector_t sec_no, size_t cnt) {
 	struct channel *c = d->channel;
 
-	ASSERT (sec_no < d->capacity);
-	ASSERT (sec_no < (1UL << 28));
+	ASSERT (cnt > 0 && cnt <= MAX_SECTORS_PER_CMD);
+	ASSERT (sec_no + cnt <= d->capacity);
+	ASSERT (sec_no + cnt <= (1UL << 28));
 
 	select_device_wait (d);
-	outb (reg_nsect (c), 1);
+	outb (reg_nsect (c), cnt == MAX_SECTORS_PER_CMD ? 0 : cnt);
 	outb (reg_lbal (c), sec_no);
 	outb (reg_lbam (c), sec_no >> 8);
 	outb (reg_lbah (c), (sec_no >> 16));
@@ -446,6 +772,152 @@ output_sector (struct channel *c, const void *sector) {
 	outsw (reg_data (c), sector, DISK_SECTOR_SIZE / 2);
 }
 
+/* Reads CNT sectors starting at SEC_NO from disk D with one PIO
+   command, into the buffers of the requests in BATCH in turn.  The
+   disk interrupts as each sector becomes ready.  Called only from
+   the channel's driver thread. */
+static void
+pio_read (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		struct list *batch) {
+	struct channel *c = d->channel;
+	struct list_elem *e;
+	size_t i = 0;
+
+	select_sector (d, sec_no, cnt);
+	issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+	for (e = list_begin (batch); e != list_end (batch); e = list_next (e)) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+		size_t j;
+
+		for (j = 0; j < r->cnt; j++, i++) {
+			sema_down (&c->completion_wait);
+			if (!wait_while_busy (d))
+				PANIC ("%s: disk read failed, sector=%"PRDSNu,
+						d->name, (disk_sector_t) (sec_no + i));
+			input_sector (c, (uint8_t *) r->buffer + j * DISK_SECTOR_SIZE);
+		}
+	}
+}
+
+/* Writes CNT sectors starting at SEC_NO on disk D with one PIO
+   command, from the buffers of the requests in BATCH in turn.  The
+   disk interrupts as it takes each sector.  Called only from the
+   channel's driver thread. */
+static void
+pio_write (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		struct list *batch) {
+	struct channel *c = d->channel;
+	struct list_elem *e;
+	size_t i = 0;
+
+	select_sector (d, sec_no, cnt);
+	issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
+	for (e = list_begin (batch); e != list_end (batch); e = list_next (e)) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+		size_t j;
+
+		for (j = 0; j < r->cnt; j++, i++) {
+			if (!wait_while_busy (d))
+				PANIC ("%s: disk write failed, sector=%"PRDSNu,
+						d->name, (disk_sector_t) (sec_no + i));
+			output_sector (c, (uint8_t *) r->buffer + j * DISK_SECTOR_SIZE);
+			sema_down (&c->completion_wait);
+		}
+	}
+}
+
+/* Bus-master DMA. */
+
+/* Looks for a PCI IDE controller that can act as bus master and
+   allows it to.  Returns the I/O base of its bus-master registers,
+   or 0 if there is none. */
+static uint16_t
+find_bus_master (void) {
+	struct pci_dev ide;
+	uint32_t bm_base;
+
+	if (!pci_find_class (0x01, 0x01, &ide)        /* Mass storage, IDE. */
+			|| (ide.prog_if & 0x80) == 0)         /* Bus master capable. */
+		return 0;
+	bm_base = pci_io_bar (&ide, 4);
+	if (bm_base == 0)
+		return 0;
+	pci_enable (&ide, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+	return bm_base;
+}
+
+/* Returns true if CNT sectors can be moved between disk D and
+   BUFFER by DMA.  The controller reaches only 32-bit physical
+   addresses, through the kernel's mapping of physical memory, and
+   transfers 16-bit words. */
+static bool
+dma_usable (const struct disk *d, const void *buffer, size_t cnt) {
+	return (d->dma
+			&& is_kernel_vaddr (buffer)
+			&& (uintptr_t) buffer % 2 == 0
+			&& vtop (buffer) + cnt * DISK_SECTOR_SIZE <= (1ULL << 32));
+}
+
+/* Fills in the PRD table of channel C to describe the buffers of
+   the requests in BATCH in turn. */
+static void
+build_prdt (struct channel *c, struct list *batch) {
+	struct prd *prd = c->prdt;
+	struct list_elem *e;
+
+	for (e = list_begin (batch); e != list_end (batch); e = list_next (e)) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+		uint64_t addr = vtop (r->buffer);
+		size_t size = r->cnt * DISK_SECTOR_SIZE;
+
+		while (size > 0) {
+			size_t chunk = PRD_BOUNDARY - addr % PRD_BOUNDARY;
+
+			ASSERT (prd < c->prdt + PGSIZE / sizeof *prd);
+			if (chunk > size)
+				chunk = size;
+			prd->addr = addr;
+			prd->size = chunk;
+			prd->flags = 0;
+			prd++;
+			addr += chunk;
+			size -= chunk;
+		}
+	}
+	prd[-1].flags = PRD_EOT;
+}
+
+/* Moves CNT sectors starting at SEC_NO between disk D and the
+   buffers of the requests in BATCH by DMA: to the disk if WRITE is
+   true, from it if false.  The thread sleeps until the disk signals
+   completion through its interrupt.  Called only from the channel's
+   driver thread. */
+static void
+dma_transfer (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		struct list *batch, bool write) {
+	struct channel *c = d->channel;
+	uint8_t direction = write ? 0 : BMC_READ;
+	uint8_t bm_status;
+
+	build_prdt (c, batch);
+	outl (reg_bm_prdt (c), vtop (c->prdt));
+	outb (reg_bm_command (c), direction);
+	outb (reg_bm_status (c), inb (reg_bm_status (c)) | BMS_ERROR | BMS_INTR);
+
+	select_sector (d, sec_no, cnt);
+	issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+	outb (reg_bm_command (c), direction | BMC_START);
+	sema_down (&c->completion_wait);
+
+	/* Stop the engine and clear its interrupt and error bits. */
+	outb (reg_bm_command (c), direction);
+	bm_status = inb (reg_bm_status (c));
+	outb (reg_bm_status (c), bm_status);
+	if ((bm_status & BMS_ERROR) || (inb (reg_alt_status (c)) & STA_ERR))
+		PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+				d->name, write ? "write" : "read", sec_no);
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
@@ -0,0 +1,177 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* Access to PCI configuration space through configuration
+   mechanism #1, the one every PC chipset since the early PCI days
+   implements: a 32-bit address is written to CONFIG_ADDRESS and
+   the register it names is then read or written through
+   CONFIG_DATA.
+
+   Refer to [PCI] for the details. */
+
+#define CONFIG_ADDRESS 0xcf8    /* Configuration address port. */
+#define CONFIG_DATA 0xcfc       /* Configuration data port. */
+#define CONFIG_ENABLE 0x80000000 /* Address bit that enables access. */
+
+/* Registers read while scanning the bus. */
+#define REG_ID 0x00             /* Vendor ID and Device ID. */
+#define REG_CLASS 0x08          /* Revision, prog. i/f, subclass, class. */
+#define REG_HEADER 0x0c         /* Includes the header type. */
+#define HEADER_MULTI_FUNC 0x800000 /* In REG_HEADER: has functions 1-7. */
+
+#define NO_DEVICE 0xffff        /* Vendor ID read from an empty slot. */
+
+/* Reads 32-bit register REG, which must be aligned, of function
+   FUNC of device SLOT on bus BUS. */
+static uint32_t
+read_config (uint8_t bus, uint8_t slot, uint8_t func, uint8_t reg) {
+	ASSERT (reg % 4 == 0);
+
+	outl (CONFIG_ADDRESS, CONFIG_ENABLE | (bus << 16) | (slot << 11)
+			| (func << 8) | reg);
+	return inl (CONFIG_DATA);
+}
+
+/* Fills in DEV for function FUNC of device SLOT on bus BUS.
+   Returns false if there is no such function. */
+static bool
+probe (uint8_t bus, uint8_t slot, uint8_t func, struct pci_dev *dev) {
+	uint32_t id = read_config (bus, slot, func, REG_ID);
+	uint32_t class;
+
+	if ((id & 0xffff) == NO_DEVICE)
+		return false;
+	class = read_config (bus, slot, func, REG_CLASS);
+	dev->bus = bus;
+	dev->slot = slot;
+	dev->func = func;
+	dev->vendor_id = id;
+	dev->device_id = id >> 16;
+	dev->class = class >> 24;
+	dev->subclass = class >> 16;
+	dev->prog_if = class >> 8;
+	return true;
+}
+
+/* Scans every bus for the first function for which MATCH returns
+   true when passed it and AUX, and stores it in *DEV.  Returns
+   false if there is none. */
+static bool
+pci_find (bool (*match) (const struct pci_dev *, const void *aux),
+		const void *aux, struct pci_dev *dev) {
+	int bus, slot, func;
+
+	for (bus = 0; bus < 256; bus++)
+		for (slot = 0; slot < 32; slot++) {
+			int func_cnt = 1;
+
+			for (func = 0; func < func_cnt; func++) {
+				if (!probe (bus, slot, func, dev))
+					continue;
+				if (func == 0 && (read_config (bus, slot, 0, REG_HEADER)
+							& HEADER_MULTI_FUNC))
+					func_cnt = 8;
+				if (match (dev, aux))
+					return true;
+			}
+		}
+	return false;
+}
+
+/* Class code to look for. */
+struct class_code {
+	uint8_t class;
+	uint8_t subclass;
+};
+
+static bool
+class_matches (const struct pci_dev *dev, const void *code_) {
+	const struct class_code *code = code_;
+	return dev->class == code->class && dev->subclass == code->subclass;
+}
+
+static bool
+id_matches (const struct pci_dev *dev, const void *id_) {
+	const struct pci_dev *id = id_;
+	return dev->vendor_id == id->vendor_id && dev->device_id == id->device_id;
+}
+
+/* Finds the first function of class CLASS and subclass SUBCLASS
+   and stores it in *DEV.  Returns false if there is none. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_dev *dev) {
+	struct class_code code = { class, subclass };
+	return pci_find (class_matches, &code, dev);
+}
+
+/* Finds the first function with vendor VENDOR_ID and device
+   DEVICE_ID and stores it in *DEV.  Returns false if there is
+   none. */
+bool
+pci_find_device (uint16_t vendor_id, uint16_t device_id,
+		struct pci_dev *dev) {
+	struct pci_dev id = { .vendor_id = vendor_id, .device_id = device_id };
+	return pci_find (id_matches, &id, dev);
+}
+
+/* Returns the 32-bit configuration register REG of DEV. */
+uint32_t
+pci_read_config (const struct pci_dev *dev, uint8_t reg) {
+	return read_config (dev->bus, dev->slot, dev->func, reg);
+}
+
+/* Sets the 32-bit configuration register REG of DEV to VALUE. */
+void
+pci_write_config (const struct pci_dev *dev, uint8_t reg, uint32_t value) {
+	ASSERT (reg % 4 == 0);
+
+	outl (CONFIG_ADDRESS, CONFIG_ENABLE | (dev->bus << 16)
+			| (dev->slot << 11) | (dev->func << 8) | reg);
+	outl (CONFIG_DATA, value);
+}
+
+/* Returns the 16-bit configuration register REG of DEV. */
+uint16_t
+pci_read_config16 (const struct pci_dev *dev, uint8_t reg) {
+	ASSERT (reg % 2 == 0);
+	return pci_read_config (dev, reg & ~3) >> (reg % 4 * 8);
+}
+
+/* Sets the 16-bit configuration register REG of DEV to VALUE,
+   leaving the other half of its 32-bit register alone. */
+void
+pci_write_config16 (const struct pci_dev *dev, uint8_t reg, uint16_t value) {
+	int shift = reg % 4 * 8;
+	uint32_t word;
+
+	ASSERT (reg % 2 == 0);
+	word = pci_read_config (dev, reg & ~3);
+	word = (word & ~(0xffffu << shift)) | ((uint32_t) value << shift);
+	pci_write_config (dev, reg & ~3, word);
+}
+
+/* Returns the 8-bit configuration register REG of DEV. */
+uint8_t
+pci_read_config8 (const struct pci_dev *dev, uint8_t reg) {
+	return pci_read_config (dev, reg & ~3) >> (reg % 4 * 8);
+}
+
+/* Returns the I/O port base of DEV's base address register BAR,
+   or 0 if that register does not describe I/O space. */
+uint32_t
+pci_io_bar (const struct pci_dev *dev, int bar) {
+	uint32_t value;
+
+	ASSERT (bar >= 0 && bar < 6);
+	value = pci_read_config (dev, PCI_BAR0 + bar * 4);
+	return value & PCI_BAR_IO ? value & PCI_BAR_IO_MASK : 0;
+}
+
+/* Turns on the COMMAND bits, a set of PCI_COMMAND_* flags, in DEV's
+   command register. */
+void
+pci_enable (const struct pci_dev *dev, uint16_t command) {
+	pci_write_config16 (dev, PCI_COMMAND,
+			pci_read_config16 (dev, PCI_COMMAND) | command);
+}
@@ -3,6 +3,8 @@
 #include "filesys/filesys.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
+#include <bitmap.h>
+#include <round.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -24,6 +26,8 @@ struct fat_fs {
 	disk_sector_t data_start;
 	cluster_t last_clst;
 	struct lock write_lock;
+	struct bitmap *used_clusters;   /* One bit per cluster, set if in use. */
+	struct bitmap *dirty_sectors;   /* FAT sectors changed since written. */
 };
 
 static struct fat_fs *fat_fs;
@@ -53,6 +57,7 @@ fat_init (void) {
 
 void
 fat_open (void) {
+	free (fat_fs->fat);
 	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
 	if (fat_fs->fat == NULL)
 		PANIC ("FAT load failed");
@@ -77,6 +82,32 @@ fat_open (void) {
 			bytes_read += bytes_left;
 			free (bounce);
 		}
+		if (bytes_read >= fat_size_in_bytes)
+			break;
+	}
+
+	// Index the clusters in use, so allocation does not search the FAT
+	bitmap_mark (fat_fs->used_clusters, 0);
+	for (cluster_t clst = 1; clst < fat_fs->fat_length; clst++)
+		if (fat_fs->fat[clst] != 0)
+			bitmap_mark (fat_fs->used_clusters, clst);
+}
+
+/* Writes sector IDX of the FAT to the disk, through BOUNCE if it
+ * holds the partial last part of the FAT. */
+static void
+fat_write_sector (size_t idx, uint8_t *bounce) {
+	const uint8_t *buffer = (const uint8_t *) fat_fs->fat;
+	const size_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
+	const size_t ofs = idx * DISK_SECTOR_SIZE;
+
+	ASSERT (ofs < fat_size_in_bytes);
+	if (fat_size_in_bytes - ofs >= DISK_SECTOR_SIZE)
+		disk_write (filesys_disk, fat_fs->bs.fat_start + idx, buffer + ofs);
+	else {
+		memset (bounce, 0, DISK_SECTOR_SIZE);
+		memcpy (bounce, buffer + ofs, fat_size_in_bytes - ofs);
+		disk_write (filesys_disk, fat_fs->bs.fat_start + idx, bounce);
 	}
 }
 
@@ -90,27 +121,17 @@ fat_close (void) {
 	disk_write (filesys_disk, FAT_BOOT_SECTOR, bounce);
 	free (bounce);
 
-	// Write FAT directly to the disk
-	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_wrote = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
-	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_wrote;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i,
-			            buffer + bytes_wrote);
-			bytes_wrote += DISK_SECTOR_SIZE;
-		} else {
-			bounce = calloc (1, DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT close failed");
-			memcpy (bounce, buffer + bytes_wrote, bytes_left);
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			bytes_wrote += bytes_left;
-			free (bounce);
-		}
-	}
+	// Write the FAT sectors that changed since they were last written
+	bounce = malloc (DISK_SECTOR_SIZE);
+	if (bounce == NULL)
+		PANIC ("FAT close failed");
+	lock_acquire (&fat_fs->write_lock);
+	size_t idx = 0;
+	while ((idx = bitmap_scan_and_flip (fat_fs->dirty_sectors, idx, 1, true))
+			!= BITMAP_ERROR)
+		fat_write_sector (idx++, bounce);
+	lock_release (&fat_fs->write_lock);
+	free (bounce);
 }
 
 void
@@ -125,8 +146,15 @@ fat_create (void) {
 		PANIC ("FAT creation failed");
 
 	// Set up ROOT_DIR_CLST
+	bitmap_mark (fat_fs->used_clusters, 0);
+	bitmap_mark (fat_fs->used_clusters, ROOT_DIR_CLUSTER);
 	fat_put (ROOT_DIR_CLUSTER, EOChain);
 
+	// The whole FAT is new
+	bitmap_set_multiple (fat_fs->dirty_sectors, 0,
+			DIV_ROUND_UP (fat_fs->fat_length * sizeof (cluster_t),
+				DISK_SECTOR_SIZE), true);
+
 	// Fill up ROOT_DIR_CLUSTER region with 0
 	uint8_t *buf = calloc (1, DISK_SECTOR_SIZE);
 	if (buf == NULL)
@@ -152,42 +180,96 @@ fat_boot_create (void) {
 
 void
 fat_fs_init (void) {
-	/* TODO: Your code goes here. */
+	/* The data region follows the FAT.  Cluster 0 stands for "no
+	 * cluster", so cluster N is stored at data_start + N - 1. */
+	const unsigned int entries_per_sector = DISK_SECTOR_SIZE / sizeof (cluster_t);
+	fat_fs->data_start = fat_fs->bs.fat_start + fat_fs->bs.fat_sectors;
+	fat_fs->fat_length = (fat_fs->bs.total_sectors - fat_fs->data_start)
+		/ SECTORS_PER_CLUSTER + 1;
+	if (fat_fs->fat_length > fat_fs->bs.fat_sectors * entries_per_sector)
+		fat_fs->fat_length = fat_fs->bs.fat_sectors * entries_per_sector;
+	fat_fs->last_clst = 0;
+	lock_init (&fat_fs->write_lock);
+
+	bitmap_destroy (fat_fs->used_clusters);
+	bitmap_destroy (fat_fs->dirty_sectors);
+	fat_fs->used_clusters = bitmap_create (fat_fs->fat_length);
+	fat_fs->dirty_sectors = bitmap_create (fat_fs->bs.fat_sectors);
+	if (fat_fs->used_clusters == NULL || fat_fs->dirty_sectors == NULL)
+		PANIC ("FAT init failed");
 }
 
 /*----------------------------------------------------------------------------*/
 /* FAT handling                                                               */
 /*----------------------------------------------------------------------------*/
 
+/* Chains are walked from their first cluster with fat_get().  A
+ * per-inode cache of (offset, cluster) checkpoints for seeking into
+ * long chains is left out until inode.c lays files out in clusters;
+ * today it still allocates sectors from the free map. */
+
 /* Add a cluster to the chain.
  * If CLST is 0, start a new chain.
  * Returns 0 if fails to allocate a new cluster. */
 cluster_t
 fat_create_chain (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	size_t new_clst;
+
+	lock_acquire (&fat_fs->write_lock);
+	/* Next fit: clusters of a growing file tend to come out in a row. */
+	new_clst = bitmap_scan_and_flip_next (fat_fs->used_clusters, 1, false);
+	if (new_clst == BITMAP_ERROR) {
+		lock_release (&fat_fs->write_lock);
+		return 0;
+	}
+	fat_put (new_clst, EOChain);
+	if (clst != 0)
+		fat_put (clst, new_clst);
+	lock_release (&fat_fs->write_lock);
+	return new_clst;
 }
 
 /* Remove the chain of clusters starting from CLST.
  * If PCLST is 0, assume CLST as the start of the chain. */
 void
 fat_remove_chain (cluster_t clst, cluster_t pclst) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	if (pclst != 0)
+		fat_put (pclst, EOChain);
+	while (clst != 0 && clst != EOChain) {
+		cluster_t next = fat_get (clst);
+
+		fat_put (clst, 0);
+		bitmap_reset (fat_fs->used_clusters, clst);
+		clst = next;
+	}
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Update a value in the FAT table. */
 void
 fat_put (cluster_t clst, cluster_t val) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+
+	if (fat_fs->fat[clst] != val) {
+		fat_fs->fat[clst] = val;
+		bitmap_mark (fat_fs->dirty_sectors,
+				clst * sizeof (cluster_t) / DISK_SECTOR_SIZE);
+	}
 }
 
 /* Fetch a value in the FAT table. */
 cluster_t
 fat_get (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+
+	return fat_fs->fat[clst];
 }
 
 /* Covert a cluster # to a sector number. */
 disk_sector_t
 cluster_to_sector (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+
+	return fat_fs->data_start + (clst - 1) * SECTORS_PER_CLUSTER;
 }
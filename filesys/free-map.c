@@ -1,6 +1,7 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
@@ -8,40 +9,87 @@
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
 
+/* Sectors of the free map file whose part of the free map changed
+ * since it was last written, one bit per sector of the file. */
+static struct bitmap *free_map_dirty;
+
+/* Bits of the free map held by one sector of its file. */
+#define BITS_PER_SECTOR (DISK_SECTOR_SIZE * 8)
+
 /* Initializes the free map. */
 void
 free_map_init (void) {
 	free_map = bitmap_create (disk_size (filesys_disk));
 	if (free_map == NULL)
 		PANIC ("bitmap creation failed--disk is too large");
+	free_map_dirty = bitmap_create (DIV_ROUND_UP (bitmap_size (free_map),
+				BITS_PER_SECTOR));
+	if (free_map_dirty == NULL)
+		PANIC ("bitmap creation failed--disk is too large");
 	bitmap_mark (free_map, FREE_MAP_SECTOR);
 	bitmap_mark (free_map, ROOT_DIR_SECTOR);
 }
 
-/* Allocates CNT consecutive sectors from the free map and stores
- * the first into *SECTORP.
- * Returns true if successful, false if all sectors were
- * available. */
+/* Notes that the bits for CNT sectors starting at SECTOR changed. */
+static void
+mark_dirty (disk_sector_t sector, size_t cnt) {
+	size_t first, last;
+
+	if (cnt == 0)
+		return;
+	first = sector / BITS_PER_SECTOR;
+	last = (sector + cnt - 1) / BITS_PER_SECTOR;
+	bitmap_set_multiple (free_map_dirty, first, last - first + 1, true);
+}
+
+/* Allocates CNT consecutive sectors from the free map, as close
+ * after sector NEAR as possible, and stores the first into *SECTORP.
+ * Placing a file's data right after its inode, and an inode near
+ * its directory's, keeps what is read together close on disk.
+ * Returns true if successful, false if not enough consecutive
+ * sectors were available.
+ * The change reaches the disk at the next free_map_flush(). */
 bool
-free_map_allocate (size_t cnt, disk_sector_t *sectorp) {
-	disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-	if (sector != BITMAP_ERROR
-			&& free_map_file != NULL
-			&& !bitmap_write (free_map, free_map_file)) {
-		bitmap_set_multiple (free_map, sector, cnt, false);
-		sector = BITMAP_ERROR;
-	}
-	if (sector != BITMAP_ERROR)
-		*sectorp = sector;
-	return sector != BITMAP_ERROR;
+free_map_allocate_near (size_t cnt, disk_sector_t near,
+		disk_sector_t *sectorp) {
+	size_t sector = BITMAP_ERROR;
+
+	if (near < bitmap_size (free_map))
+		sector = bitmap_scan_and_flip (free_map, near, cnt, false);
+	if (sector == BITMAP_ERROR)
+		sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+	if (sector == BITMAP_ERROR)
+		return false;
+	mark_dirty (sector, cnt);
+	*sectorp = sector;
+	return true;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Makes CNT sectors starting at SECTOR available for use.
+ * The change reaches the disk at the next free_map_flush(). */
 void
 free_map_release (disk_sector_t sector, size_t cnt) {
 	ASSERT (bitmap_all (free_map, sector, cnt));
 	bitmap_set_multiple (free_map, sector, cnt, false);
-	bitmap_write (free_map, free_map_file);
+	mark_dirty (sector, cnt);
+}
+
+/* Writes the sectors of the free map that changed since the last
+ * flush back to disk.  Called once a file system operation is done
+ * changing the map, so each sector it touched is written once. */
+void
+free_map_flush (void) {
+	size_t idx = 0;
+
+	if (free_map_file == NULL)
+		return;
+	while ((idx = bitmap_scan (free_map_dirty, idx, 1, true))
+			!= BITMAP_ERROR) {
+		if (bitmap_write_part (free_map, free_map_file,
+					idx * DISK_SECTOR_SIZE, DISK_SECTOR_SIZE))
+			bitmap_reset (free_map_dirty, idx);
+		idx++;
+	}
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -57,7 +105,9 @@ free_map_open (void) {
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) {
+	free_map_flush ();
 	file_close (free_map_file);
+	free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -74,4 +124,5 @@ free_map_create (void) {
 		PANIC ("can't open free map");
 	if (!bitmap_write (free_map, free_map_file))
 		PANIC ("can't write free map");
+	bitmap_set_all (free_map_dirty, false);
 }
@@ -1,22 +1,54 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "userprog/syscall.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Bytes of data that fit in the inode sector itself. */
+#define INODE_INLINE_MAX 496
+
+/* Block map: sectors listed in the inode itself, and in an index
+ * sector.  Together with the indirect and doubly indirect sectors,
+ * the map fills the space of the inline data. */
+#define INODE_DIRECT_CNT 122
+#define INODE_PTRS_PER_SECTOR (DISK_SECTOR_SIZE / sizeof (disk_sector_t))
+#define INODE_MAX_SECTORS (INODE_DIRECT_CNT + INODE_PTRS_PER_SECTOR	\
+		+ INODE_PTRS_PER_SECTOR * INODE_PTRS_PER_SECTOR)
+
+/* Sectors set aside at a time for the data of a file being written,
+ * so that it is laid out contiguously. */
+#define INODE_PREALLOC_CNT 8
+
+/* Inode flags.  With neither set, the data is in the sectors from
+ * START on. */
+#define INODE_INLINE 0x1                /* Data is in inline_data. */
+#define INODE_MAPPED 0x2                /* Data is in the block map. */
+
 /* On-disk inode.
- * Must be exactly DISK_SECTOR_SIZE bytes long. */
+ * Must be exactly DISK_SECTOR_SIZE bytes long.
+ * Entries of the block map are 0 for holes, which read as zeros and
+ * get a sector when first written. */
 struct inode_disk {
 	disk_sector_t start;                /* First data sector. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
-	uint32_t unused[125];               /* Not used. */
+	uint32_t flags;                     /* INODE_* flags. */
+	union {
+		uint8_t inline_data[INODE_INLINE_MAX]; /* Data of a small file. */
+		struct {
+			disk_sector_t direct[INODE_DIRECT_CNT];
+			disk_sector_t indirect;     /* Index of the next sectors. */
+			disk_sector_t doubly_indirect; /* Index of indexes. */
+		};
+	};
 };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,35 +60,233 @@ bytes_to_sectors (off_t size) {
 
 /* In-memory inode. */
 struct inode {
-	struct list_elem elem;              /* Element in inode list. */
+	struct hash_elem elem;              /* Element in open_inodes. */
 	disk_sector_t sector;               /* Sector number of disk location. */
 	int open_cnt;                       /* Number of openers. */
 	bool removed;                       /* True if deleted, false otherwise. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+	int write_map_cnt;                  /* Number of writable mmap()s. */
 	struct inode_disk data;             /* Inode content. */
+
+	/* Block map access. */
+	disk_sector_t index_sector;         /* Index sector in INDEX, or 0. */
+	disk_sector_t index[INODE_PTRS_PER_SECTOR]; /* Last index sector read. */
+	disk_sector_t next_sector;          /* Where new data should go. */
+	disk_sector_t prealloc_start;       /* Sectors set aside for data. */
+	size_t prealloc_cnt;                /* Number of them left. */
 };
 
+/* Returns true if INODE's data is kept in its inode sector, which
+ * saves small files a data sector and a disk read. */
+static inline bool
+inode_is_inline (const struct inode *inode) {
+	return (inode->data.flags & INODE_INLINE) != 0;
+}
+
+/* Returns the entries of index sector SECTOR of INODE.  The last
+ * index sector read is kept in memory. */
+static disk_sector_t *
+index_load (struct inode *inode, disk_sector_t sector) {
+	if (inode->index_sector != sector) {
+		disk_read (filesys_disk, sector, inode->index);
+		inode->index_sector = sector;
+	}
+	return inode->index;
+}
+
+/* Returns a sector for data of INODE, preferring the run set aside
+ * for it, or 0 if the disk is full. */
+static disk_sector_t
+inode_allocate_data (struct inode *inode) {
+	disk_sector_t sector;
+
+	if (inode->prealloc_cnt == 0) {
+		if (free_map_allocate_near (INODE_PREALLOC_CNT, inode->next_sector,
+					&inode->prealloc_start))
+			inode->prealloc_cnt = INODE_PREALLOC_CNT;
+		else if (free_map_allocate_near (1, inode->next_sector,
+					&inode->prealloc_start))
+			inode->prealloc_cnt = 1;
+		else
+			return 0;
+	}
+	sector = inode->prealloc_start++;
+	inode->prealloc_cnt--;
+	inode->next_sector = sector + 1;
+	return sector;
+}
+
+/* Returns entry IDX of ENTRIES, a part of INODE's block map that is
+ * stored in sector HOME.  If the entry is empty and ALLOCATE is
+ * true, fills it with a new sector first: a zeroed index sector if
+ * INDEX is true, otherwise a data sector, setting *FRESH to say that
+ * its contents on disk are garbage.  Returns 0 for an empty entry,
+ * or if the disk is full. */
+static disk_sector_t
+map_entry (struct inode *inode, disk_sector_t *entries, disk_sector_t home,
+		size_t idx, bool allocate, bool index, bool *fresh) {
+	disk_sector_t sector = entries[idx];
+
+	if (sector != 0 || !allocate)
+		return sector;
+
+	if (!index)
+		sector = inode_allocate_data (inode);
+	else if (!free_map_allocate_near (1, inode->next_sector, &sector))
+		sector = 0;
+	if (sector == 0)
+		return 0;
+
+	entries[idx] = sector;
+	if (home == inode->sector)
+		disk_write (filesys_disk, home, &inode->data);
+	else
+		disk_write (filesys_disk, home, entries);
+
+	if (index) {
+		memset (inode->index, 0, DISK_SECTOR_SIZE);
+		inode->index_sector = sector;
+		disk_write (filesys_disk, sector, inode->index);
+	} else
+		*fresh = true;
+	return sector;
+}
+
 /* Returns the disk sector that contains byte offset POS within
- * INODE.
- * Returns -1 if INODE does not contain data for a byte at offset
- * POS. */
+ * INODE, or 0 if POS lies in a hole.  If ALLOCATE is true, a hole
+ * is given a sector first, and *FRESH is set if that happened; then
+ * 0 means the disk is full. */
 static disk_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) {
+byte_to_sector (struct inode *inode, off_t pos, bool allocate, bool *fresh) {
+	size_t idx = pos / DISK_SECTOR_SIZE;
+	disk_sector_t sector;
+
 	ASSERT (inode != NULL);
-	if (pos < inode->data.length)
-		return inode->data.start + pos / DISK_SECTOR_SIZE;
-	else
-		return -1;
+	ASSERT (!inode_is_inline (inode));
+
+	*fresh = false;
+	if ((inode->data.flags & INODE_MAPPED) == 0)
+		return inode->data.start + idx;
+
+	if (idx < INODE_DIRECT_CNT)
+		return map_entry (inode, inode->data.direct, inode->sector, idx,
+				allocate, false, fresh);
+	idx -= INODE_DIRECT_CNT;
+
+	if (idx < INODE_PTRS_PER_SECTOR)
+		sector = map_entry (inode, &inode->data.indirect, inode->sector, 0,
+				allocate, true, fresh);
+	else {
+		idx -= INODE_PTRS_PER_SECTOR;
+		ASSERT (idx < INODE_PTRS_PER_SECTOR * INODE_PTRS_PER_SECTOR);
+		sector = map_entry (inode, &inode->data.doubly_indirect, inode->sector,
+				0, allocate, true, fresh);
+		if (sector == 0)
+			return 0;
+		sector = map_entry (inode, index_load (inode, sector), sector,
+				idx / INODE_PTRS_PER_SECTOR, allocate, true, fresh);
+		idx %= INODE_PTRS_PER_SECTOR;
+	}
+	if (sector == 0)
+		return 0;
+	return map_entry (inode, index_load (inode, sector), sector, idx,
+			allocate, false, fresh);
+}
+
+/* Returns how many of the MAX full sectors of INODE from byte POS
+ * on lie in consecutive sectors from SECTOR, the one that holds
+ * byte POS, so that they can be moved with one disk command.  With
+ * ALLOCATE true, holes among them are given sectors on the way, and
+ * *ALLOCATED is set if that happened. */
+static size_t
+sector_run (struct inode *inode, off_t pos, disk_sector_t sector,
+		size_t max, bool allocate, bool *allocated) {
+	size_t cnt;
+
+	for (cnt = 1; cnt < max; cnt++) {
+		bool fresh;
+		disk_sector_t next = byte_to_sector (inode,
+				pos + cnt * DISK_SECTOR_SIZE, allocate, &fresh);
+
+		*allocated |= fresh;
+		if (next != sector + cnt)
+			break;
+	}
+	return cnt;
+}
+
+/* Frees SECTOR, an index sector LEVELS above the data if LEVELS is
+ * nonzero, together with all the sectors it lists. */
+static void
+release_map (disk_sector_t sector, int levels) {
+	if (sector == 0)
+		return;
+	if (levels > 0) {
+		disk_sector_t *entries = malloc (DISK_SECTOR_SIZE);
+		size_t i;
+
+		/* Without memory the listed sectors are leaked. */
+		if (entries != NULL) {
+			disk_read (filesys_disk, sector, entries);
+			for (i = 0; i < INODE_PTRS_PER_SECTOR; i++)
+				release_map (entries[i], levels - 1);
+			free (entries);
+		}
+	}
+	free_map_release (sector, 1);
 }
 
-/* List of open inodes, so that opening a single inode twice
- * returns the same `struct inode'. */
-static struct list open_inodes;
+/* Frees the sectors that hold INODE's data. */
+static void
+inode_release_data (struct inode *inode) {
+	size_t i;
+
+	if (inode_is_inline (inode))
+		return;
+	if ((inode->data.flags & INODE_MAPPED) == 0) {
+		free_map_release (inode->data.start,
+				bytes_to_sectors (inode->data.length));
+		return;
+	}
+	for (i = 0; i < INODE_DIRECT_CNT; i++)
+		release_map (inode->data.direct[i], 0);
+	release_map (inode->data.indirect, 1);
+	release_map (inode->data.doubly_indirect, 2);
+}
+
+/* Open inodes, keyed by sector, so that opening a single inode
+ * twice returns the same `struct inode'.  open_inodes_lock guards
+ * the table and the inodes' open counts. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+
+static uint64_t inode_hash (const struct hash_elem *, void *);
+static bool inode_less (const struct hash_elem *, const struct hash_elem *,
+		void *);
 
 /* Initializes the inode module. */
 void
 inode_init (void) {
-	list_init (&open_inodes);
+	hash_init (&open_inodes, inode_hash, inode_less, NULL);
+	lock_init (&open_inodes_lock);
+}
+
+/* Returns the open inode for SECTOR with a new reference, or a null
+ * pointer if it is not open.  Must be called with open_inodes_lock
+ * held. */
+static struct inode *
+open_inodes_find (disk_sector_t sector) {
+	struct inode key;
+	struct hash_elem *e;
+	struct inode *inode;
+
+	key.sector = sector;
+	e = hash_find (&open_inodes, &key.elem);
+	if (e == NULL)
+		return NULL;
+	inode = hash_entry (e, struct inode, elem);
+	inode->open_cnt++;
+	return inode;
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -75,22 +305,18 @@ inode_create (disk_sector_t sector, off_t length) {
 	 * one sector in size, and you should fix that. */
 	ASSERT (sizeof *disk_inode == DISK_SECTOR_SIZE);
 
+	if (bytes_to_sectors (length) > INODE_MAX_SECTORS)
+		return false;
+
+	/* Data sectors are allocated as they are written. */
 	disk_inode = calloc (1, sizeof *disk_inode);
 	if (disk_inode != NULL) {
-		size_t sectors = bytes_to_sectors (length);
 		disk_inode->length = length;
 		disk_inode->magic = INODE_MAGIC;
-		if (free_map_allocate (sectors, &disk_inode->start)) {
-			disk_write (filesys_disk, sector, disk_inode);
-			if (sectors > 0) {
-				static char zeros[DISK_SECTOR_SIZE];
-				size_t i;
-
-				for (i = 0; i < sectors; i++) 
-					disk_write (filesys_disk, disk_inode->start + i, zeros); 
-			}
-			success = true; 
-		} 
+		disk_inode->flags = length <= INODE_INLINE_MAX
+			? INODE_INLINE : INODE_MAPPED;
+		disk_write (filesys_disk, sector, disk_inode);
+		success = true;
 		free (disk_inode);
 	}
 	return success;
@@ -101,18 +327,14 @@ inode_create (disk_sector_t sector, off_t length) {
  * Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (disk_sector_t sector) {
-	struct list_elem *e;
-	struct inode *inode;
+	struct inode *inode, *open;
 
 	/* Check whether this inode is already open. */
-	for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-			e = list_next (e)) {
-		inode = list_entry (e, struct inode, elem);
-		if (inode->sector == sector) {
-			inode_reopen (inode);
-			return inode; 
-		}
-	}
+	lock_acquire (&open_inodes_lock);
+	inode = open_inodes_find (sector);
+	lock_release (&open_inodes_lock);
+	if (inode != NULL)
+		return inode;
 
 	/* Allocate memory. */
 	inode = malloc (sizeof *inode);
@@ -120,20 +342,37 @@ inode_open (disk_sector_t sector) {
 		return NULL;
 
 	/* Initialize. */
-	list_push_front (&open_inodes, &inode->elem);
 	inode->sector = sector;
 	inode->open_cnt = 1;
 	inode->deny_write_cnt = 0;
+	inode->write_map_cnt = 0;
 	inode->removed = false;
+	inode->index_sector = 0;
+	inode->next_sector = sector + 1;
+	inode->prealloc_cnt = 0;
 	disk_read (filesys_disk, inode->sector, &inode->data);
+
+	/* Another thread may have opened it while we read the disk. */
+	lock_acquire (&open_inodes_lock);
+	open = open_inodes_find (sector);
+	if (open == NULL)
+		hash_insert (&open_inodes, &inode->elem);
+	lock_release (&open_inodes_lock);
+	if (open != NULL) {
+		free (inode);
+		return open;
+	}
 	return inode;
 }
 
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode) {
-	if (inode != NULL)
+	if (inode != NULL) {
+		lock_acquire (&open_inodes_lock);
 		inode->open_cnt++;
+		lock_release (&open_inodes_lock);
+	}
 	return inode;
 }
 
@@ -148,24 +387,43 @@ inode_get_inumber (const struct inode *inode) {
  * If INODE was also a removed inode, frees its blocks. */
 void
 inode_close (struct inode *inode) {
+	bool last;
+
 	/* Ignore null pointer. */
 	if (inode == NULL)
 		return;
 
 	/* Release resources if this was the last opener. */
-	if (--inode->open_cnt == 0) {
-		/* Remove from inode list and release lock. */
-		list_remove (&inode->elem);
+	lock_acquire (&open_inodes_lock);
+	last = --inode->open_cnt == 0;
+	if (last)
+		hash_delete (&open_inodes, &inode->elem);
+	lock_release (&open_inodes_lock);
+
+	if (last && (inode->prealloc_cnt > 0 || inode->removed)) {
+		/* The last close can come from munmap() or exit() as well as
+		 * close(), so take the file system lock for the free map. */
+		bool locked = !lock_held_by_current_thread (&filesys_lock);
+
+		if (locked)
+			lock_acquire (&filesys_lock);
+
+		/* Give back the sectors set aside but not written. */
+		if (inode->prealloc_cnt > 0)
+			free_map_release (inode->prealloc_start, inode->prealloc_cnt);
 
 		/* Deallocate blocks if removed. */
 		if (inode->removed) {
 			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
-					bytes_to_sectors (inode->data.length)); 
+			inode_release_data (inode);
 		}
+		free_map_flush ();
 
-		free (inode); 
+		if (locked)
+			lock_release (&filesys_lock);
 	}
+	if (last)
+		free (inode); 
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -185,9 +443,19 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	off_t bytes_read = 0;
 	uint8_t *bounce = NULL;
 
+	if (inode_is_inline (inode)) {
+		if (offset >= inode_length (inode) || size <= 0)
+			return 0;
+		if (size > inode_length (inode) - offset)
+			size = inode_length (inode) - offset;
+		memcpy (buffer, inode->data.inline_data + offset, size);
+		return size;
+	}
+
 	while (size > 0) {
 		/* Disk sector to read, starting byte offset within sector. */
-		disk_sector_t sector_idx = byte_to_sector (inode, offset);
+		disk_sector_t sector_idx;
+		bool fresh;
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
 		/* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -200,9 +468,20 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Read full sector directly into caller's buffer. */
-			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
+		sector_idx = byte_to_sector (inode, offset, false, &fresh);
+		if (sector_idx == 0) {
+			/* A hole reads as zeros. */
+			memset (buffer + bytes_read, 0, chunk_size);
+		} else if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
+			/* Read full sectors directly into caller's buffer, as many
+			 * as are consecutive on disk at once. */
+			off_t left = size < inode_left ? size : inode_left;
+			size_t cnt = sector_run (inode, offset, sector_idx,
+					left / DISK_SECTOR_SIZE, false, &fresh);
+
+			disk_read_multiple (filesys_disk, sector_idx, cnt,
+					buffer + bytes_read);
+			chunk_size = cnt * DISK_SECTOR_SIZE;
 		} else {
 			/* Read sector into bounce buffer, then partially copy
 			 * into caller's buffer. */
@@ -236,13 +515,26 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
 	uint8_t *bounce = NULL;
+	bool allocated = false;
 
 	if (inode->deny_write_cnt)
 		return 0;
 
+	if (inode_is_inline (inode)) {
+		/* Write the whole inode sector through. */
+		if (offset >= inode_length (inode) || size <= 0)
+			return 0;
+		if (size > inode_length (inode) - offset)
+			size = inode_length (inode) - offset;
+		memcpy (inode->data.inline_data + offset, buffer, size);
+		disk_write (filesys_disk, inode->sector, &inode->data);
+		return size;
+	}
+
 	while (size > 0) {
 		/* Sector to write, starting byte offset within sector. */
-		disk_sector_t sector_idx = byte_to_sector (inode, offset);
+		disk_sector_t sector_idx;
+		bool fresh;
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
 		/* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -255,9 +547,22 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		if (chunk_size <= 0)
 			break;
 
+		/* A hole gets its sector now. */
+		sector_idx = byte_to_sector (inode, offset, true, &fresh);
+		if (sector_idx == 0)
+			break;
+		allocated |= fresh;
+
 		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Write full sector directly to disk. */
-			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
+			/* Write full sectors directly to disk, as many as are
+			 * consecutive on disk at once. */
+			off_t left = size < inode_left ? size : inode_left;
+			size_t cnt = sector_run (inode, offset, sector_idx,
+					left / DISK_SECTOR_SIZE, true, &allocated);
+
+			disk_write_multiple (filesys_disk, sector_idx, cnt,
+					buffer + bytes_written);
+			chunk_size = cnt * DISK_SECTOR_SIZE;
 		} else {
 			/* We need a bounce buffer. */
 			if (bounce == NULL) {
@@ -268,8 +573,9 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 
 			/* If the sector contains data before or after the chunk
 			   we're writing, then we need to read in the sector
-			   first.  Otherwise we start with a sector of all zeros. */
-			if (sector_ofs > 0 || chunk_size < sector_left) 
+			   first.  Otherwise, or if the sector was a hole until
+			   now, we start with a sector of all zeros. */
+			if (!fresh && (sector_ofs > 0 || chunk_size < sector_left))
 				disk_read (filesys_disk, sector_idx, bounce);
 			else
 				memset (bounce, 0, DISK_SECTOR_SIZE);
@@ -283,6 +589,8 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		bytes_written += chunk_size;
 	}
 	free (bounce);
+	if (allocated)
+		free_map_flush ();
 
 	return bytes_written;
 }
@@ -306,8 +614,47 @@ inode_allow_write (struct inode *inode) {
 	inode->deny_write_cnt--;
 }
 
+/* Returns true if writes to INODE are denied. */
+bool
+inode_write_denied (const struct inode *inode) {
+	return inode->deny_write_cnt > 0;
+}
+
+/* Records a writable mapping of INODE, which stores into the page
+ * cache's frames of INODE directly. */
+void
+inode_map_writable (struct inode *inode) {
+	inode->write_map_cnt++;
+}
+
+/* Drops a mapping recorded by inode_map_writable(). */
+void
+inode_unmap_writable (struct inode *inode) {
+	ASSERT (inode->write_map_cnt > 0);
+	inode->write_map_cnt--;
+}
+
+/* Returns true if INODE has writable mappings. */
+bool
+inode_mapped_writable (const struct inode *inode) {
+	return inode->write_map_cnt > 0;
+}
+
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode) {
 	return inode->data.length;
 }
+
+static uint64_t
+inode_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct inode *inode = hash_entry (e, struct inode, elem);
+	return hash_int (inode->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct inode, elem)->sector
+		< hash_entry (b, struct inode, elem)->sector;
+}
@@ -1,6 +1,27 @@
-/* page_cache.c: Implementation of Page Cache (Buffer Cache). */
+/* page_cache.c: Implementation of Page Cache (Buffer Cache).
+ *
+ * The page cache holds the data of mmap()ed files, a page at a time,
+ * keyed by inode and page-aligned offset, so that every process that
+ * maps the same part of a file maps the same frame.  A page of the
+ * cache is a struct page of its own that belongs to no process; the
+ * pages of processes map its frame with vm_frame_share().  It stays
+ * in the cache while any of them refers to it.
+ *
+ * Whether the data was modified is read from the dirty bits of the
+ * PTEs that map it.  Modified data is written back when the frame is
+ * evicted, when a process unmaps the page, and every few seconds by
+ * a worker thread. */
 
 #include "vm/vm.h"
+#ifdef VM
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/syscall.h"
+
 static bool page_cache_readahead (struct page *page, void *kva);
 static bool page_cache_writeback (struct page *page);
 static void page_cache_destroy (struct page *page);
@@ -15,36 +36,229 @@ static const struct page_operations page_cache_op = {
 
 tid_t page_cache_workerd;
 
+/* Cached pages, keyed by inode and offset. */
+static struct hash page_cache;
+static struct lock page_cache_lock;
+
+/* Timer ticks between write-backs by the worker thread. */
+#define PAGE_CACHE_FLUSH_TICKS (5 * TIMER_FREQ)
+
+static uint64_t page_cache_hash (const struct hash_elem *, void *);
+static bool page_cache_less (const struct hash_elem *,
+		const struct hash_elem *, void *);
+static void page_cache_kworkerd (void *aux);
+
+/* Sets up the page cache. */
+void
+page_cache_init (void) {
+	hash_init (&page_cache, page_cache_hash, page_cache_less, NULL);
+	lock_init (&page_cache_lock);
+}
+
 /* The initializer of file vm */
 void
 pagecache_init (void) {
-	/* TODO: Create a worker daemon for page cache with page_cache_kworkerd */
+	page_cache_workerd = thread_create ("page_cache", PRI_DEFAULT,
+			page_cache_kworkerd, NULL);
 }
 
 /* Initialize the page cache */
 bool
-page_cache_initializer (struct page *page, enum vm_type type, void *kva) {
+page_cache_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &page_cache_op;
 
+	struct page_cache *page_cache = &page->page_cache;
+	page_cache->inode = NULL;
+	page_cache->ofs = 0;
+	page_cache->ref_cnt = 0;
+	return true;
+}
+
+/* Returns the page of the cache that holds the page of INODE at OFS,
+ * creating it if needed, with a new reference for the caller to
+ * drop with page_cache_put().  Returns a null pointer if memory runs
+ * out. */
+struct page *
+page_cache_get (struct inode *inode, off_t ofs) {
+	struct page_cache key;
+	struct hash_elem *e;
+	struct page *page;
+
+	key.inode = inode;
+	key.ofs = ofs;
+	lock_acquire (&page_cache_lock);
+	e = hash_find (&page_cache, &key.elem);
+	if (e != NULL) {
+		page = hash_entry (e, struct page, page_cache.elem);
+		page->page_cache.ref_cnt++;
+	} else {
+		page = malloc (sizeof *page);
+		if (page != NULL) {
+			*page = (struct page) { .va = NULL };
+			page_cache_initializer (page, VM_PAGE_CACHE, NULL);
+			page->page_cache.inode = inode_reopen (inode);
+			page->page_cache.ofs = ofs;
+			page->page_cache.ref_cnt = 1;
+			hash_insert (&page_cache, &page->page_cache.elem);
+		}
+	}
+	lock_release (&page_cache_lock);
+	return page;
+}
+
+/* Drops a reference to PAGE, freeing it once none are left. */
+void
+page_cache_put (struct page *page) {
+	bool last;
+
+	lock_acquire (&page_cache_lock);
+	last = --page->page_cache.ref_cnt == 0;
+	if (last)
+		hash_delete (&page_cache, &page->page_cache.elem);
+	lock_release (&page_cache_lock);
+
+	if (last)
+		vm_dealloc_page (page);
+}
+
+/* Writes the page at KVA back to the file.  The file is not
+ * extended: only the bytes before its end are written. */
+static void
+page_cache_write (struct page *page, const void *kva) {
+	struct page_cache *page_cache = &page->page_cache;
+	off_t length = inode_length (page_cache->inode);
+
+	if (length > page_cache->ofs)
+		inode_write_at (page_cache->inode, kva,
+				length - page_cache->ofs < PGSIZE
+				? length - page_cache->ofs : PGSIZE, page_cache->ofs);
+}
+
+/* Writes PAGE back if it is resident and a process modified it.
+ * If WAIT is false and another thread holds the file system lock,
+ * gives up and returns false. */
+static bool
+page_cache_sync (struct page *page, bool wait) {
+	bool locked;
+
+	if (!vm_frame_pin (page))
+		return true;
+
+	/* Most pages are clean: skip the file system lock for them. */
+	if (!vm_frame_dirty (page, false)) {
+		vm_frame_unpin (page);
+		return true;
+	}
+
+	locked = !lock_held_by_current_thread (&filesys_lock);
+	if (locked) {
+		if (wait)
+			lock_acquire (&filesys_lock);
+		else if (!lock_try_acquire (&filesys_lock)) {
+			vm_frame_unpin (page);
+			return false;
+		}
+	}
+	/* Clear the dirty bits before writing, so that a store that
+	 * races with the write sets them again. */
+	if (vm_frame_dirty (page, true))
+		page_cache_write (page, page->frame->kva);
+	if (locked)
+		lock_release (&filesys_lock);
+
+	vm_frame_unpin (page);
+	return true;
+}
+
+/* Writes back CACHE if it was modified, then unmaps it from PAGE. */
+void
+page_cache_unmap (struct page *page, struct page *cache) {
+	page_cache_sync (cache, true);
+	vm_frame_unshare (page);
 }
 
 /* Utilze the Swap in mechanism to implement readhead */
 static bool
 page_cache_readahead (struct page *page, void *kva) {
+	struct page_cache *page_cache = &page->page_cache;
+	bool locked = !lock_held_by_current_thread (&filesys_lock);
+	off_t read_bytes;
+
+	if (locked)
+		lock_acquire (&filesys_lock);
+	read_bytes = inode_read_at (page_cache->inode, kva, PGSIZE,
+			page_cache->ofs);
+	if (locked)
+		lock_release (&filesys_lock);
+
+	memset ((uint8_t *) kva + read_bytes, 0, PGSIZE - read_bytes);
+	return true;
 }
 
-/* Utilze the Swap out mechanism to implement writeback */
+/* Utilze the Swap out mechanism to implement writeback.  Called
+ * during eviction, with the mapping PTEs cleared but still holding
+ * their dirty bits, and must not wait for the file system lock. */
 static bool
 page_cache_writeback (struct page *page) {
+	bool locked;
+
+	if (!vm_frame_dirty (page, false))
+		return true;
+
+	locked = !lock_held_by_current_thread (&filesys_lock);
+	if (locked && !lock_try_acquire (&filesys_lock))
+		return false;
+	page_cache_write (page, page->frame->kva);
+	if (locked)
+		lock_release (&filesys_lock);
+	return true;
 }
 
-/* Destory the page_cache. */
+/* Destory the page_cache.  Every process page has unmapped it and
+ * written it back by now. */
 static void
 page_cache_destroy (struct page *page) {
+	void *kva = vm_frame_detach (page);
+
+	if (kva != NULL)
+		palloc_free_page (kva);
+	inode_close (page->page_cache.inode);
 }
 
 /* Worker thread for page cache */
 static void
-page_cache_kworkerd (void *aux) {
+page_cache_kworkerd (void *aux UNUSED) {
+	for (;;) {
+		struct hash_iterator i;
+
+		timer_sleep (PAGE_CACHE_FLUSH_TICKS);
+		lock_acquire (&page_cache_lock);
+		hash_first (&i, &page_cache);
+		while (hash_next (&i))
+			page_cache_sync (hash_entry (hash_cur (&i), struct page,
+						page_cache.elem), false);
+		lock_release (&page_cache_lock);
+	}
+}
+
+static uint64_t
+page_cache_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct page_cache *page_cache =
+		hash_entry (e, struct page_cache, elem);
+	return hash_bytes (&page_cache->inode, sizeof page_cache->inode)
+		^ hash_int (page_cache->ofs);
+}
+
+static bool
+page_cache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct page_cache *a = hash_entry (a_, struct page_cache, elem);
+	const struct page_cache *b = hash_entry (b_, struct page_cache, elem);
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	return a->ofs < b->ofs;
 }
+#endif /* VM */
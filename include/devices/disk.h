@@ -2,7 +2,11 @@
 #define DEVICES_DISK_H
 
 #include <inttypes.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include "threads/synch.h"
 
 /* Size of a disk sector in bytes. */
 #define DISK_SECTOR_SIZE 512
@@ -15,6 +19,35 @@ typedef uint32_t disk_sector_t;
  * printf ("sector=%"PRDSNu"\n", sector); */
 #define PRDSNu PRIu32
 
+/* Most sectors a single request may transfer. */
+#define DISK_REQUEST_MAX 256
+
+/* An asynchronous request to move CNT sectors starting at SEC_NO
+ * between DISK and BUFFER, which must be a kernel address, since
+ * the request is carried out by a driver thread that has no user
+ * address space.  Set up with disk_request_init(), optionally set
+ * COMPLETE and AUX, then pass to disk_submit().  The request must
+ * stay alive until it completes. */
+struct disk_request {
+	struct disk *disk;          /* Disk to access. */
+	disk_sector_t sec_no;       /* First sector. */
+	size_t cnt;                 /* Number of sectors. */
+	void *buffer;               /* CNT * DISK_SECTOR_SIZE bytes. */
+	bool write;                 /* Write to disk, or read from it? */
+
+	/* Called when the request completes, from the disk's driver
+	 * thread, which it must not block on I/O to the same channel.
+	 * If null, completion ups DONE instead, for disk_wait(). */
+	void (*complete) (struct disk_request *);
+	void *aux;                  /* For COMPLETE's use. */
+
+	/* Owned by the driver. */
+	struct list_elem elem;      /* Position in sector order. */
+	struct list_elem fifo_elem; /* Position in submission order. */
+	int64_t time;               /* Tick when submitted. */
+	struct semaphore done;      /* Up'd on completion without COMPLETE. */
+};
+
 void disk_init (void);
 void disk_print_stats (void);
 
@@ -22,6 +55,14 @@ struct disk *disk_get (int chan_no, int dev_no);
 disk_sector_t disk_size (struct disk *);
 void disk_read (struct disk *, disk_sector_t, void *);
 void disk_write (struct disk *, disk_sector_t, const void *);
+void disk_read_multiple (struct disk *, disk_sector_t, size_t cnt, void *);
+void disk_write_multiple (struct disk *, disk_sector_t, size_t cnt,
+		const void *);
+
+void disk_request_init (struct disk_request *, struct disk *, disk_sector_t,
+		size_t cnt, void *buffer, bool write);
+void disk_submit (struct disk_request *);
+void disk_wait (struct disk_request *);
 
 void 	register_disk_inspect_intr ();
 #endif /* devices/disk.h */
@@ -0,0 +1,45 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A function of a device on the PCI bus. */
+struct pci_dev {
+	uint8_t bus;                /* Bus number. */
+	uint8_t slot;               /* Device number on the bus. */
+	uint8_t func;               /* Function number in the device. */
+	uint16_t vendor_id;         /* Vendor ID. */
+	uint16_t device_id;         /* Device ID. */
+	uint8_t class;              /* Base class code. */
+	uint8_t subclass;           /* Subclass code. */
+	uint8_t prog_if;            /* Programming interface. */
+};
+
+/* Configuration space registers. */
+#define PCI_COMMAND 0x04        /* Command (16 bits). */
+#define PCI_BAR0 0x10           /* Base address 0 (32 bits); 5 more follow. */
+#define PCI_INTERRUPT_LINE 0x3c /* Interrupt line (8 bits). */
+
+/* Command register bits. */
+#define PCI_COMMAND_IO 0x1      /* Respond to I/O space accesses. */
+#define PCI_COMMAND_MEMORY 0x2  /* Respond to memory space accesses. */
+#define PCI_COMMAND_MASTER 0x4  /* Allow bus mastering (DMA). */
+
+/* Base address register bits. */
+#define PCI_BAR_IO 0x1          /* The BAR is in I/O space. */
+#define PCI_BAR_IO_MASK (~0x3u) /* Address bits of an I/O space BAR. */
+
+bool pci_find_class (uint8_t class, uint8_t subclass, struct pci_dev *);
+bool pci_find_device (uint16_t vendor_id, uint16_t device_id,
+		struct pci_dev *);
+
+uint32_t pci_read_config (const struct pci_dev *, uint8_t reg);
+void pci_write_config (const struct pci_dev *, uint8_t reg, uint32_t);
+uint16_t pci_read_config16 (const struct pci_dev *, uint8_t reg);
+void pci_write_config16 (const struct pci_dev *, uint8_t reg, uint16_t);
+uint8_t pci_read_config8 (const struct pci_dev *, uint8_t reg);
+uint32_t pci_io_bar (const struct pci_dev *, int bar);
+void pci_enable (const struct pci_dev *, uint16_t command);
+
+#endif /* devices/pci.h */
@@ -1,12 +1,24 @@
 #ifndef FILESYS_PAGE_CACHE_H
 #define FILESYS_PAGE_CACHE_H
+#include <hash.h>
+#include "filesys/off_t.h"
 #include "vm/vm.h"
 
 struct page;
 enum vm_type;
 
-struct page_cache {};
+/* A page of file data in the page cache. */
+struct page_cache {
+	struct inode *inode;        /* File that the data belongs to. */
+	off_t ofs;                  /* Offset of the data in the file. */
+	size_t ref_cnt;             /* Number of pages that refer to it. */
+	struct hash_elem elem;      /* Element in the page cache. */
+};
 
 void page_cache_init (void);
+void pagecache_init (void);
 bool page_cache_initializer (struct page *page, enum vm_type type, void *kva);
+struct page *page_cache_get (struct inode *inode, off_t ofs);
+void page_cache_put (struct page *page);
+void page_cache_unmap (struct page *page, struct page *cache);
 #endif
@@ -0,0 +1,63 @@
+#ifndef __LIB_KERNEL_INTERVAL_H
+#define __LIB_KERNEL_INTERVAL_H
+
+/* Interval tree.
+ *
+ * A set of half-open intervals [START, END) that answers "which
+ * interval overlaps this range?" in O(log n) time, however many
+ * intervals it holds.  It is an AVL tree ordered by START in which
+ * every node also records the greatest END in its subtree, so that
+ * a search can skip any subtree that ends before the range begins.
+ * Intervals in the same tree may overlap each other.
+ *
+ * Like the list and hash table, the tree does no dynamic
+ * allocation.  Each structure that can be in a tree embeds a
+ * struct interval_elem member, and interval_entry converts a
+ * pointer to that member back into a pointer to the structure.
+ * Refer to lib/kernel/list.h for a detailed explanation of this
+ * technique. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Interval tree element. */
+struct interval_elem {
+	uint64_t start;                 /* First value in the interval. */
+	uint64_t end;                   /* One past the last value. */
+	uint64_t max_end;               /* Greatest END in this subtree. */
+	struct interval_elem *left;     /* Subtree of earlier intervals. */
+	struct interval_elem *right;    /* Subtree of later intervals. */
+	int height;                     /* Height of this subtree. */
+};
+
+/* Converts pointer to interval element INTERVAL_ELEM into a pointer
+ * to the structure that INTERVAL_ELEM is embedded inside.  Supply
+ * the name of the outer structure STRUCT and the member name MEMBER
+ * of the interval element. */
+#define interval_entry(INTERVAL_ELEM, STRUCT, MEMBER)           \
+	((STRUCT *) ((uint8_t *) &(INTERVAL_ELEM)->start        \
+		- offsetof (STRUCT, MEMBER.start)))
+
+/* Interval tree. */
+struct interval_tree {
+	struct interval_elem *root;     /* Root node, or null if empty. */
+	size_t elem_cnt;                /* Number of elements in tree. */
+};
+
+void interval_init (struct interval_tree *);
+
+void interval_insert (struct interval_tree *, struct interval_elem *,
+		uint64_t start, uint64_t end);
+void interval_remove (struct interval_tree *, struct interval_elem *);
+struct interval_elem *interval_search (struct interval_tree *,
+		uint64_t start, uint64_t end);
+
+struct interval_elem *interval_first (struct interval_tree *);
+struct interval_elem *interval_next (struct interval_tree *,
+		struct interval_elem *);
+
+size_t interval_size (struct interval_tree *);
+bool interval_empty (struct interval_tree *);
+
+#endif /* lib/kernel/interval.h */
@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -14,10 +15,24 @@ enum palloc_flags {
 /* Maximum number of pages to put in user pool. */
 extern size_t user_page_limit;
 
+/* A small per-thread stack of free single pages from one pool.
+   Refilled from and drained to the pool PALLOC_MAG_SIZE / 2 pages
+   at a time, so most single-page allocations and frees by a thread
+   never touch the pool's free lists. */
+#define PALLOC_MAG_SIZE 8
+struct palloc_magazine {
+	size_t cnt;                         /* Number of cached pages. */
+	void *pages[PALLOC_MAG_SIZE];       /* Cached free pages. */
+};
+
 uint64_t palloc_init (void);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
+void *palloc_get_huge_page (enum palloc_flags);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+void palloc_drain_magazines (void);
+bool palloc_zero_free_page (void);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
@@ -41,5 +41,15 @@
 #define PTE_U 0x4                        /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20                       /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40                       /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80                      /* 1=2 MB page (PDEs only). */
+
+/* A page-directory entry with PTE_PS set maps a whole 2 MB "huge"
+   page directly, with no page table below it. */
+#define HUGE_PGSIZE (1UL << PDXSHIFT)    /* Bytes in a huge page. */
+#define HUGE_PGMASK (HUGE_PGSIZE - 1)    /* Huge page offset bits (0:21). */
+#define HUGE_PGCNT (HUGE_PGSIZE / PGSIZE) /* Small pages per huge page. */
+
+/* Offset within a huge page. */
+#define huge_pg_ofs(va) ((uint64_t) (va) & HUGE_PGMASK)
 
 #endif /* threads/pte.h */
@@ -5,6 +5,7 @@
 #include <list.h>
 #include <stdint.h>
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
 #ifdef VM
 #include "vm/vm.h"
@@ -99,7 +100,8 @@ struct thread
 	int64_t wakeup_ticks;	   // 깨어날 tick
 
 	/* Shared between thread.c and synch.c. */
-	struct list_elem elem; /* List element. */
+	struct list_elem elem;	   /* List element. */
+	struct list_elem all_elem; /* Element in all threads list. */
 
 	int init_priority;
 	struct lock *wait_on_lock;
@@ -120,6 +122,9 @@ struct thread
 
 	struct file *running; // 현재 실행중인 파일
 
+	/* Owned by threads/palloc.c. */
+	struct palloc_magazine palloc_mags[2]; /* Kernel, user pool caches. */
+
 #ifdef USERPROG
 	/* Owned by userprog/process.c. */
 	uint64_t *pml4; /* Page map level 4 */
@@ -127,6 +132,7 @@ struct thread
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
 	struct supplemental_page_table spt;
+	void *user_rsp; /* User stack pointer at system call entry. */
 #endif
 
 	/* Owned by thread.c. */
@@ -148,6 +154,9 @@ void thread_print_stats(void);
 typedef void thread_func(void *aux);
 tid_t thread_create(const char *name, int priority, thread_func *, void *);
 
+typedef void thread_action_func(struct thread *t, void *aux);
+void thread_foreach(thread_action_func *, void *);
+
 void thread_block(void);
 void thread_unblock(struct thread *);
 
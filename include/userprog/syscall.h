@@ -3,5 +3,5 @@
 #include "threads/synch.h"
 
 void syscall_init(void);
-struct lock filesys_lock;
+extern struct lock filesys_lock;
 #endif /* userprog/syscall.h */
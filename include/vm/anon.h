@@ -1,10 +1,15 @@
 #ifndef VM_ANON_H
 #define VM_ANON_H
+#include <stddef.h>
 #include "vm/vm.h"
 struct page;
 enum vm_type;
 
 struct anon_page {
+	size_t swap_slot;           /* Slot holding the page, or BITMAP_ERROR. */
+	size_t zswap_idx;           /* Compressed copy's granule, or BITMAP_ERROR. */
+	size_t zswap_len;           /* Compressed copy's length in bytes. */
+	struct page *ksm;           /* Merged page mapped instead, or NULL. */
 };
 
 void vm_anon_init (void);
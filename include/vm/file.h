@@ -1,17 +1,57 @@
 #ifndef VM_FILE_H
 #define VM_FILE_H
+#include <list.h>
 #include "filesys/file.h"
 #include "vm/vm.h"
 
 struct page;
+struct supplemental_page_table;
 enum vm_type;
 
+/* A region of a process's address space mapped by one mmap(). */
+struct mmap_region {
+	struct vm_region base;      /* First, so a region of type
+	                               VM_REGION_MMAP casts to this. */
+	void *addr;                 /* First mapped page. */
+	size_t page_cnt;            /* Number of mapped pages. */
+	bool writable;              /* Counted by inode_map_writable()? */
+};
+
+/* Where a lazily loaded page's contents come from: READ_BYTES bytes
+ * of FILE at OFS, followed by zeros.  This is the AUX of every page
+ * created with an initializer.  FILE is the handle of REGION, the
+ * segment or mmap() region that the page belongs to. */
+struct file_load_info {
+	struct file *file;
+	off_t ofs;
+	size_t read_bytes;
+	struct vm_region *region;
+};
+
 struct file_page {
+	struct vm_region *region;   /* Region that the page belongs to. */
+	struct file *file;          /* REGION's file. */
+	off_t ofs;                  /* Offset of the page's data in the file. */
+	size_t read_bytes;          /* Bytes of file data; the rest are zero. */
+	struct page *cache;         /* Page cache entry, once claimed. */
 };
 
 void vm_file_init (void);
 bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
+bool file_lazy_load (struct page *page, void *aux);
+bool file_backed_claim (struct page *page, bool evict);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
+
+struct file_load_info *file_load_info_copy (struct supplemental_page_table *,
+		const struct file_load_info *);
+struct file_load_info *file_page_load_info (struct supplemental_page_table *,
+		struct page *);
+bool file_load_info_read (const struct file_load_info *, void *kva);
+void file_load_info_free (struct file_load_info *);
+bool file_mmap_copy (struct supplemental_page_table *dst,
+		const struct mmap_region *);
+void file_mmap_remove (struct supplemental_page_table *,
+		struct mmap_region *);
 #endif
@@ -0,0 +1,13 @@
+#ifndef VM_KSM_H
+#define VM_KSM_H
+
+/* Merging of anonymous pages with the same contents. */
+
+struct page;
+
+void ksm_init (void);
+void ksm_start (void);
+void ksm_put (struct page *ksm);
+void ksm_print_stats (void);
+
+#endif /* vm/ksm.h */
@@ -1,5 +1,8 @@
 #ifndef VM_VM_H
 #define VM_VM_H
+#include <hash.h>
+#include <interval.h>
+#include <list.h>
 #include <stdbool.h>
 #include "threads/palloc.h"
 
@@ -24,18 +27,50 @@ enum vm_type {
 	VM_MARKER_END = (1 << 31),
 };
 
+/* Kinds of regions of a process's address space. */
+enum vm_region_type {
+	VM_REGION_SEGMENT,          /* Code or data of the executable. */
+	VM_REGION_STACK,            /* Room for the user stack to grow. */
+	VM_REGION_MMAP,             /* One mmap(), a struct mmap_region. */
+};
+
+/* A range of a process's address space set aside for one purpose.
+ * No two regions of a process overlap. */
+struct vm_region {
+	struct interval_elem elem;  /* Element in the spt's regions tree. */
+	enum vm_region_type type;
+	struct file *file;          /* Handle shared by the pages, or null. */
+};
+
 #include "vm/uninit.h"
 #include "vm/anon.h"
 #include "vm/file.h"
-#ifdef EFILESYS
 #include "filesys/page_cache.h"
-#endif
 
 struct page_operations;
 struct thread;
 
 #define VM_TYPE(type) ((type) & 7)
 
+/* Marks pages of the user stack. */
+#define VM_STACK VM_MARKER_0
+
+/* Most bytes the user stack may grow to. */
+#define VM_STACK_LIMIT (1 << 20)
+
+/* Pages read in around a fault on file data. */
+extern size_t vm_fault_around;
+
+/* How a process expects to use a range of its pages, as told to
+ * madvise().  The values match MADV_* in lib/user/syscall.h. */
+enum vm_advice {
+	VM_ADVICE_NORMAL,           /* No special treatment. */
+	VM_ADVICE_RANDOM,           /* No fault-around. */
+	VM_ADVICE_SEQUENTIAL,       /* Read ahead, evict soon after use. */
+	VM_ADVICE_WILLNEED,         /* Bring the pages in now. */
+	VM_ADVICE_DONTNEED,         /* Free the pages' frames now. */
+};
+
 /* The representation of "page".
  * This is kind of "parent class", which has four "child class"es, which are
  * uninit_page, file_page, anon_page, and page cache (project4).
@@ -46,6 +81,12 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	struct hash_elem spt_elem;  /* Element in owner's supplemental table. */
+	struct thread *owner;       /* Process whose address space holds VA. */
+	bool writable;              /* May the user write to VA? */
+	struct list_elem map_elem;  /* Element in its frame's maps list. */
+	bool zero;                  /* Mapped read-only to the zero frame? */
+	enum vm_advice advice;      /* NORMAL, RANDOM or SEQUENTIAL. */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -53,16 +94,22 @@ struct page {
 		struct uninit_page uninit;
 		struct anon_page anon;
 		struct file_page file;
-#ifdef EFILESYS
 		struct page_cache page_cache;
-#endif
 	};
 };
 
-/* The representation of "frame" */
+/* The representation of "frame".
+ * PAGE is the page whose contents the frame holds, and whose
+ * operations write them out on eviction.  MAPS lists the pages of
+ * processes that map the frame: usually just PAGE itself, but a
+ * frame of the page cache may be mapped by any number of pages. */
 struct frame {
 	void *kva;
 	struct page *page;
+	struct list_elem elem;      /* Element in the frame table. */
+	struct list maps;           /* Pages mapping the frame. */
+	int pinned;                 /* Never chosen for eviction if nonzero. */
+	bool loading;               /* Contents still being read in? */
 };
 
 /* The function table for page operations.
@@ -85,6 +132,8 @@ struct page_operations {
  * We don't want to force you to obey any specific design for this struct.
  * All designs up to you for this. */
 struct supplemental_page_table {
+	struct hash pages;          /* All pages of the process, keyed by va. */
+	struct interval_tree regions; /* struct vm_region, keyed by address. */
 };
 
 #include "threads/thread.h"
@@ -96,6 +145,15 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 		void *va);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
+bool spt_add_region (struct supplemental_page_table *spt,
+		struct vm_region *region, enum vm_region_type type,
+		void *start, void *end);
+void spt_remove_region (struct supplemental_page_table *spt,
+		struct vm_region *region);
+struct vm_region *spt_find_region (struct supplemental_page_table *spt,
+		void *start, void *end);
+struct vm_region *vm_reserve_region (enum vm_region_type type, void *start,
+		void *end, struct file *file);
 
 void vm_init (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
@@ -108,5 +166,17 @@ bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 void vm_dealloc_page (struct page *page);
 bool vm_claim_page (void *va);
 enum vm_type page_get_type (struct page *page);
+bool vm_is_stack_access (void *addr, void *rsp);
+bool vm_madvise (void *addr, size_t length, enum vm_advice advice);
+void *vm_frame_detach (struct page *page);
+bool vm_frame_share (struct page *page, struct page *owner, bool evict);
+void vm_frame_unshare (struct page *page);
+bool vm_frame_pin (struct page *page);
+void vm_frame_unpin (struct page *page);
+bool vm_frame_dirty (struct page *page, bool clear);
+void vm_zero_unmap (struct page *page);
+void vm_frame_walk (void (*fn) (struct frame *, void *),
+		void (*restart) (void *), void *aux);
+bool vm_frame_merge (struct page *ksm, struct page *page);
 
 #endif  /* VM_VM_H */
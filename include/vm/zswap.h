@@ -0,0 +1,15 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+#include <stdbool.h>
+#include <stddef.h>
+
+/* In-memory store of compressed anonymous pages, consulted before
+ * the swap disk. */
+
+void zswap_init (void);
+bool zswap_store (const void *kva, size_t *idx, size_t *len);
+void zswap_load (size_t idx, size_t len, void *kva);
+void zswap_free (size_t idx, size_t len);
+void zswap_print_stats (void);
+
+#endif /* vm/zswap.h */
@@ -26,6 +26,7 @@ typedef unsigned long elem_type;
    simulates an array of bits. */
 struct bitmap {
 	size_t bit_cnt;     /* Number of bits. */
+	size_t next_fit;    /* Where bitmap_scan_and_flip_next() starts. */
 	elem_type *bits;    /* Elements that represent bits. */
 };
 
@@ -63,6 +64,32 @@ last_mask (const struct bitmap *b) {
 	return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns the index of the first bit in B at or after START and
+   before END that is set to VALUE, or END if there is none.
+   Examines a whole element at a time, so runs of bits that are
+   all !VALUE are skipped ELEM_BITS bits per step. */
+static size_t
+find_next (const struct bitmap *b, size_t start, size_t end, bool value) {
+	elem_type flip = value ? 0 : (elem_type) -1;
+	size_t idx;
+	elem_type word;
+
+	if (start >= end)
+		return end;
+
+	/* Discard the bits below START in its element. */
+	idx = elem_idx (start);
+	word = (b->bits[idx] ^ flip) & ~(bit_mask (start) - 1);
+	while (word == 0) {
+		if (++idx >= elem_cnt (end))
+			return end;
+		word = b->bits[idx] ^ flip;
+	}
+
+	start = idx * ELEM_BITS + __builtin_ctzl (word);
+	return start < end ? start : end;
+}
+
 /* Creation and destruction. */
 
 /* Initializes B to be a bitmap of BIT_CNT bits
@@ -74,6 +101,7 @@ bitmap_create (size_t bit_cnt) {
 	struct bitmap *b = malloc (sizeof *b);
 	if (b != NULL) {
 		b->bit_cnt = bit_cnt;
+		b->next_fit = 0;
 		b->bits = malloc (byte_cnt (bit_cnt));
 		if (b->bits != NULL || bit_cnt == 0) {
 			bitmap_set_all (b, false);
@@ -94,6 +122,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED) {
 	ASSERT (block_size >= bitmap_buf_size (bit_cnt));
 
 	b->bit_cnt = bit_cnt;
+	b->next_fit = 0;
 	b->bits = (elem_type *) (b + 1);
 	bitmap_set_all (b, false);
 	return b;
@@ -228,16 +257,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
-
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			return true;
-	return false;
+	return find_next (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -263,6 +287,33 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt) {
 
 /* Finding set or unset bits. */
 
+/* Finds and returns the starting index of the first group of CNT
+   consecutive bits in B at or after START, lying entirely before
+   END, that are all set to VALUE.
+   If there is no such group, returns BITMAP_ERROR. */
+static size_t
+scan_range (const struct bitmap *b, size_t start, size_t end, size_t cnt,
+		bool value) {
+	if (cnt == 0)
+		return start;
+
+	while (end - start >= cnt) {
+		/* Skip to the next bit that is VALUE... */
+		start = find_next (b, start, end - cnt + 1, value);
+		if (start > end - cnt)
+			break;
+
+		/* ...then see how far the run of VALUE bits extends. */
+		if (cnt == 1)
+			return start;
+		size_t run_end = find_next (b, start + 1, start + cnt, !value);
+		if (run_end == start + cnt)
+			return start;
+		start = run_end + 1;
+	}
+	return BITMAP_ERROR;
+}
+
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
@@ -272,14 +323,7 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 
-	if (cnt <= b->bit_cnt) {
-		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
-				return i;
-	}
-	return BITMAP_ERROR;
+	return scan_range (b, start, b->bit_cnt, cnt, value);
 }
 
 /* Finds the first group of CNT consecutive bits in B at or after
@@ -296,6 +340,34 @@ bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value) {
 		bitmap_set_multiple (b, idx, cnt, !value);
 	return idx;
 }
+
+/* Like bitmap_scan_and_flip(), but does a next-fit search: the
+   scan starts where the previous call to this function left off
+   and wraps around to bit 0, so that allocators which repeatedly
+   take bits from a mostly-full bitmap do not rescan the full
+   prefix every time.
+   Bits are set atomically, but testing bits is not atomic with
+   setting them. */
+size_t
+bitmap_scan_and_flip_next (struct bitmap *b, size_t cnt, bool value) {
+	size_t hint, idx;
+
+	ASSERT (b != NULL);
+
+	hint = b->next_fit <= b->bit_cnt ? b->next_fit : 0;
+	idx = scan_range (b, hint, b->bit_cnt, cnt, value);
+	if (idx == BITMAP_ERROR && hint > 0) {
+		/* A group that straddles HINT may still start before it. */
+		size_t end = hint + cnt - 1;
+		idx = scan_range (b, 0, end < b->bit_cnt ? end : b->bit_cnt, cnt,
+				value);
+	}
+	if (idx != BITMAP_ERROR) {
+		bitmap_set_multiple (b, idx, cnt, !value);
+		b->next_fit = idx + cnt;
+	}
+	return idx;
+}
 
 /* File input and output. */
 
@@ -326,6 +398,23 @@ bitmap_write (const struct bitmap *b, struct file *file) {
 	off_t size = byte_cnt (b->bit_cnt);
 	return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the SIZE bytes of B that start at byte OFS to the same
+   offset in FILE, which B was read from or written to before.
+   Bytes past the end of B are not written.  Return true if
+   successful, false otherwise. */
+bool
+bitmap_write_part (const struct bitmap *b, struct file *file,
+		size_t ofs, size_t size) {
+	size_t total = byte_cnt (b->bit_cnt);
+
+	if (ofs >= total)
+		return true;
+	if (size > total - ofs)
+		size = total - ofs;
+	return file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+		== (off_t) size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
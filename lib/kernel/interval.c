@@ -0,0 +1,238 @@
+/* Interval tree.
+
+   See interval.h for basic information. */
+
+#include "interval.h"
+#include "../debug.h"
+
+static struct interval_elem *insert_elem (struct interval_elem *,
+		struct interval_elem *);
+static struct interval_elem *remove_elem (struct interval_elem *,
+		struct interval_elem *);
+static struct interval_elem *search_elem (struct interval_elem *,
+		uint64_t start, uint64_t end);
+
+/* Initializes T as an empty interval tree. */
+void
+interval_init (struct interval_tree *t) {
+	t->root = NULL;
+	t->elem_cnt = 0;
+}
+
+/* Inserts E into T as the interval [START, END), which must not be
+   empty.  E may overlap intervals already in T. */
+void
+interval_insert (struct interval_tree *t, struct interval_elem *e,
+		uint64_t start, uint64_t end) {
+	ASSERT (start < end);
+
+	e->start = start;
+	e->end = end;
+	e->max_end = end;
+	e->left = e->right = NULL;
+	e->height = 1;
+	t->root = insert_elem (t->root, e);
+	t->elem_cnt++;
+}
+
+/* Removes E, which must be in T, from T. */
+void
+interval_remove (struct interval_tree *t, struct interval_elem *e) {
+	t->root = remove_elem (t->root, e);
+	t->elem_cnt--;
+}
+
+/* Returns the interval in T that overlaps [START, END) and starts
+   first, or a null pointer if no interval in T overlaps it. */
+struct interval_elem *
+interval_search (struct interval_tree *t, uint64_t start, uint64_t end) {
+	ASSERT (start < end);
+
+	return search_elem (t->root, start, end);
+}
+
+/* Returns the interval in T that starts first, or a null pointer if
+   T is empty. */
+struct interval_elem *
+interval_first (struct interval_tree *t) {
+	struct interval_elem *e = t->root;
+
+	if (e != NULL)
+		while (e->left != NULL)
+			e = e->left;
+	return e;
+}
+
+/* Returns the interval that follows E, which must be in T, or a null
+   pointer if E is the last one.  Intervals with the same start come
+   in an arbitrary but fixed order. */
+struct interval_elem *
+interval_next (struct interval_tree *t, struct interval_elem *e) {
+	struct interval_elem *n = t->root;
+	struct interval_elem *next = NULL;
+
+	while (n != NULL)
+		if (e->start < n->start || (e->start == n->start && e < n)) {
+			next = n;
+			n = n->left;
+		} else
+			n = n->right;
+	return next;
+}
+
+/* Returns the number of intervals in T. */
+size_t
+interval_size (struct interval_tree *t) {
+	return t->elem_cnt;
+}
+
+/* Returns true if T contains no intervals, false otherwise. */
+bool
+interval_empty (struct interval_tree *t) {
+	return t->elem_cnt == 0;
+}
+
+/* Returns true if A sorts before B.  Intervals are ordered by their
+   starts, and by address when those are equal, so that every
+   element has a distinct place in the tree. */
+static bool
+elem_less (const struct interval_elem *a, const struct interval_elem *b) {
+	if (a->start != b->start)
+		return a->start < b->start;
+	return a < b;
+}
+
+/* Returns the height of subtree E, which may be null. */
+static int
+height (const struct interval_elem *e) {
+	return e != NULL ? e->height : 0;
+}
+
+/* Recomputes E's height and greatest end from its children. */
+static void
+update (struct interval_elem *e) {
+	int left = height (e->left);
+	int right = height (e->right);
+
+	e->height = (left > right ? left : right) + 1;
+	e->max_end = e->end;
+	if (e->left != NULL && e->left->max_end > e->max_end)
+		e->max_end = e->left->max_end;
+	if (e->right != NULL && e->right->max_end > e->max_end)
+		e->max_end = e->right->max_end;
+}
+
+/* Rotates subtree E right and returns its new root. */
+static struct interval_elem *
+rotate_right (struct interval_elem *e) {
+	struct interval_elem *left = e->left;
+
+	e->left = left->right;
+	left->right = e;
+	update (e);
+	update (left);
+	return left;
+}
+
+/* Rotates subtree E left and returns its new root. */
+static struct interval_elem *
+rotate_left (struct interval_elem *e) {
+	struct interval_elem *right = e->right;
+
+	e->right = right->left;
+	right->left = e;
+	update (e);
+	update (right);
+	return right;
+}
+
+/* Restores the AVL balance of subtree E, whose children are
+   balanced and differ in height by at most 2, and returns its new
+   root. */
+static struct interval_elem *
+rebalance (struct interval_elem *e) {
+	int balance;
+
+	update (e);
+	balance = height (e->left) - height (e->right);
+	if (balance > 1) {
+		if (height (e->left->left) < height (e->left->right))
+			e->left = rotate_left (e->left);
+		return rotate_right (e);
+	}
+	if (balance < -1) {
+		if (height (e->right->right) < height (e->right->left))
+			e->right = rotate_right (e->right);
+		return rotate_left (e);
+	}
+	return e;
+}
+
+/* Inserts E into subtree N and returns the subtree's new root. */
+static struct interval_elem *
+insert_elem (struct interval_elem *n, struct interval_elem *e) {
+	if (n == NULL)
+		return e;
+	if (elem_less (e, n))
+		n->left = insert_elem (n->left, e);
+	else
+		n->right = insert_elem (n->right, e);
+	return rebalance (n);
+}
+
+/* Removes the first element of subtree N, storing it in *MIN, and
+   returns the subtree's new root. */
+static struct interval_elem *
+remove_min (struct interval_elem *n, struct interval_elem **min) {
+	if (n->left == NULL) {
+		*min = n;
+		return n->right;
+	}
+	n->left = remove_min (n->left, min);
+	return rebalance (n);
+}
+
+/* Removes E from subtree N and returns the subtree's new root. */
+static struct interval_elem *
+remove_elem (struct interval_elem *n, struct interval_elem *e) {
+	ASSERT (n != NULL);
+
+	if (n == e) {
+		struct interval_elem *min;
+
+		if (n->right == NULL)
+			return n->left;
+		/* Put E's successor in its place. */
+		n->right = remove_min (n->right, &min);
+		min->left = n->left;
+		min->right = n->right;
+		return rebalance (min);
+	}
+	if (elem_less (e, n))
+		n->left = remove_elem (n->left, e);
+	else
+		n->right = remove_elem (n->right, e);
+	return rebalance (n);
+}
+
+/* Returns the first interval in subtree N that overlaps [START, END),
+   or a null pointer.  If the left subtree reaches past START but
+   holds no overlap, then its interval that does reach past START
+   begins at or after END, and so does every later interval, so at
+   most one failed descent is made and the search takes O(log n)
+   time. */
+static struct interval_elem *
+search_elem (struct interval_elem *n, uint64_t start, uint64_t end) {
+	struct interval_elem *e;
+
+	if (n == NULL || n->max_end <= start)
+		return NULL;
+	e = search_elem (n->left, start, end);
+	if (e != NULL)
+		return e;
+	if (n->start >= end)
+		return NULL;
+	if (n->end > start)
+		return n;
+	return search_elem (n->right, start, end);
+}
@@ -0,0 +1,7 @@
+/* Writes a little data near the end of a freshly created large
+   file, leaving the rest of it a hole, and checks that the hole
+   reads back as zeros, before and after reopening it. */
+
+#define TEST_SIZE 75678
+#define DATA_SIZE 1000
+#include "tests/filesys/base/sparse.inc"
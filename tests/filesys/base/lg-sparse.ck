@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF');
+(lg-sparse) begin
+(lg-sparse) create "sparse"
+(lg-sparse) open "sparse"
+(lg-sparse) write "sparse" at offset 74671
+(lg-sparse) verified contents of "sparse"
+(lg-sparse) close "sparse"
+(lg-sparse) open "sparse" for verification
+(lg-sparse) verified contents of "sparse"
+(lg-sparse) close "sparse"
+(lg-sparse) end
+EOF
+pass;
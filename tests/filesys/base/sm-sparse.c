@@ -0,0 +1,7 @@
+/* Writes a little data near the end of a freshly created small
+   file, which is kept inside its inode, and checks that the rest
+   reads back as zeros, before and after reopening it. */
+
+#define TEST_SIZE 400
+#define DATA_SIZE 100
+#include "tests/filesys/base/sparse.inc"
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF');
+(sm-sparse) begin
+(sm-sparse) create "sparse"
+(sm-sparse) open "sparse"
+(sm-sparse) write "sparse" at offset 293
+(sm-sparse) verified contents of "sparse"
+(sm-sparse) close "sparse"
+(sm-sparse) open "sparse" for verification
+(sm-sparse) verified contents of "sparse"
+(sm-sparse) close "sparse"
+(sm-sparse) end
+EOF
+pass;
@@ -0,0 +1,97 @@
+/* Gives each kind of advice about a memory mapping, checking that
+   the data survives dropping the pages and that bad arguments are
+   rejected.  Also drops a stack page, which must read back as
+   zeros, and a data page, which must come back from swap. */
+
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x10000000)
+
+/* Room for one whole page of data, wherever the array lands. */
+static char data[2 * 4096];
+
+/* Returns the first page-aligned address at or after P. */
+static char *
+page_after (char *p)
+{
+  return (char *) (((uintptr_t) p + 4095) & ~(uintptr_t) 4095);
+}
+
+/* Drops a page of the stack, which must then read back as zeros. */
+static void
+dontneed_stack (void)
+{
+  char buf[2 * 4096];
+  char *page = page_after (buf);
+  size_t i;
+
+  memset (page, 0x5a, 4096);
+  CHECK (madvise (page, 4096, MADV_DONTNEED) == 0,
+         "madvise dontneed stack page");
+  for (i = 0; i < 4096; i++)
+    if (page[i] != 0)
+      fail ("stack page not zero after madvise dontneed");
+}
+
+/* Drops a page of the executable's data, which must keep its
+   contents. */
+static void
+dontneed_data (void)
+{
+  char *page = page_after (data);
+  size_t i;
+
+  for (i = 0; i < 4096; i++)
+    page[i] = i % 251;
+  CHECK (madvise (page, 4096, MADV_DONTNEED) == 0,
+         "madvise dontneed data page");
+  for (i = 0; i < 4096; i++)
+    if (page[i] != (char) (i % 251))
+      fail ("data page changed after madvise dontneed");
+}
+
+void
+test_main (void)
+{
+  int handle;
+  void *map;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (ACTUAL, 4096, 1, handle, 0)) != MAP_FAILED,
+         "mmap \"sample.txt\"");
+
+  CHECK (madvise (map, 4096, MADV_SEQUENTIAL) == 0, "madvise sequential");
+  if (memcmp (ACTUAL, sample, strlen (sample)))
+    fail ("read of mmap'd file reported bad data");
+
+  /* Dropped pages come back from the file, with the change made
+     before dropping them. */
+  ACTUAL[0] = '*';
+  CHECK (madvise (map, 4096, MADV_DONTNEED) == 0, "madvise dontneed");
+  if (ACTUAL[0] != '*' || memcmp (ACTUAL + 1, sample + 1, strlen (sample) - 1))
+    fail ("mmap'd data changed after madvise dontneed");
+  ACTUAL[0] = sample[0];
+
+  CHECK (madvise (map, 4096, MADV_WILLNEED) == 0, "madvise willneed");
+  CHECK (madvise (map, 4096, MADV_RANDOM) == 0, "madvise random");
+  if (memcmp (ACTUAL, sample, strlen (sample)))
+    fail ("read of mmap'd file reported bad data");
+
+  CHECK (madvise (ACTUAL + 1, 4096, MADV_NORMAL) == -1,
+         "madvise misaligned address (must return -1)");
+  CHECK (madvise (map, 0, MADV_NORMAL) == -1,
+         "madvise zero length (must return -1)");
+  CHECK (madvise (map, 4096, 99) == -1,
+         "madvise bad advice (must return -1)");
+
+  munmap (map);
+  close (handle);
+
+  dontneed_stack ();
+  dontneed_data ();
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-madvise) begin
+(mmap-madvise) open "sample.txt"
+(mmap-madvise) mmap "sample.txt"
+(mmap-madvise) madvise sequential
+(mmap-madvise) madvise dontneed
+(mmap-madvise) madvise willneed
+(mmap-madvise) madvise random
+(mmap-madvise) madvise misaligned address (must return -1)
+(mmap-madvise) madvise zero length (must return -1)
+(mmap-madvise) madvise bad advice (must return -1)
+(mmap-madvise) madvise dontneed stack page
+(mmap-madvise) madvise dontneed data page
+(mmap-madvise) end
+EOF
+pass;
@@ -0,0 +1,36 @@
+/* Reads a file into a BSS page that has only been read so far, then
+   checks that another such page still reads as zeros.  Untouched
+   BSS pages share one zero frame until they are written, so the
+   kernel's store into the first must not land in that frame. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[2][4096] __attribute__ ((aligned (4096)));
+
+void
+test_main (void)
+{
+  volatile char *first = buf[0], *second = buf[1];
+  size_t size = strlen (sample);
+  int handle;
+  size_t i;
+
+  /* Reading both pages maps them to the shared zero frame. */
+  if (first[0] != 0 || second[0] != 0)
+    fail ("BSS does not start out zeroed");
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (read (handle, buf[0], size) == (int) size, "read \"sample.txt\"");
+  close (handle);
+
+  if (memcmp (buf[0], sample, size))
+    fail ("read of \"sample.txt\" reported bad data");
+  for (i = 0; i < sizeof buf[1]; i++)
+    if (second[i] != 0)
+      fail ("byte %zu of untouched page has value %02hhx (should be 0)",
+            i, second[i]);
+}
@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-zero-read) begin
+(page-zero-read) open "sample.txt"
+(page-zero-read) read "sample.txt"
+(page-zero-read) end
+EOF
+pass;
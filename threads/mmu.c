@@ -2,12 +2,90 @@
 #include <stddef.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* Process-context identifiers.
+ *
+ * When the CPU supports them, every CR3 load carries a 12-bit PCID
+ * and TLB entries are tagged with the PCID they were created under,
+ * so switching address spaces need not flush the TLB.  PCID 0 is
+ * base_pml4's.  A process pml4 gets one of the other PCID_CNT - 1
+ * PCIDs, chosen by its physical address; pcid_owner[] records which
+ * pml4 a PCID's TLB entries belong to.  A pml4 that finds its PCID
+ * owned by another one takes it over and flushes the old owner's
+ * entries as it loads CR3. */
+#define PCID_CNT 64
+#define CR3_NOFLUSH (1UL << 63)         /* Keep the new PCID's entries. */
+#define CR4_PCIDE (1UL << 17)           /* CR4: enable PCIDs. */
+#define CPUID_1_ECX_PCID (1U << 17)     /* CPUID leaf 1: PCIDs supported. */
+
+static bool pcid_enabled;
+static uint64_t *pcid_owner[PCID_CNT];
+
+/* Returns the PCID that PML4 uses, if it owns it. */
+static unsigned
+pcid_of (uint64_t *pml4) {
+	return (vtop (pml4) >> PGBITS) % (PCID_CNT - 1) + 1;
+}
+
+/* Forgets PML4's PCID, so that whatever the TLB holds for it is
+ * flushed the next time it is activated. */
+static void
+pcid_forget (uint64_t *pml4) {
+	if (pcid_enabled && pcid_owner[pcid_of (pml4)] == pml4)
+		pcid_owner[pcid_of (pml4)] = NULL;
+}
+
+/* Invalidates the TLB entry for virtual address VA in PML4.  Only
+ * the loaded address space's entries can be flushed individually;
+ * any other address space loses its PCID instead. */
+static void
+tlb_flush_page (uint64_t *pml4, uint64_t va) {
+	if (PTE_ADDR (rcr3 ()) == vtop (pml4))
+		invlpg (va);
+	else
+		pcid_forget (pml4);
+}
+
+/* Turns on PCIDs if the CPU supports them.  Called once, with
+ * base_pml4 loaded. */
+void
+pml4_init_pcid (void) {
+	uint32_t ecx;
+
+	cpuid (1, NULL, NULL, &ecx, NULL);
+	if (ecx & CPUID_1_ECX_PCID) {
+		lcr4 (rcr4 () | CR4_PCIDE);
+		pcid_enabled = true;
+	}
+}
+
+/* Replaces the 2 MB page mapped by page directory entry PDE, which
+ * contains virtual address VA, with a page table mapping the same
+ * frames with the same flags as 4 kB pages, so that part of the
+ * region can be remapped or unmapped on its own.
+ * Returns false, leaving PDE untouched, if the page table cannot
+ * be allocated. */
+static bool
+pde_split (uint64_t *pde, const uint64_t va) {
+	uint64_t *pt = palloc_get_page (0);
+	uint64_t pa = PTE_ADDR (*pde);
+	uint64_t flags = *pde & PTE_FLAGS & ~PTE_PS;
+
+	if (pt == NULL)
+		return false;
+	for (unsigned i = 0; i < HUGE_PGCNT; i++)
+		pt[i] = (pa + i * PGSIZE) | flags;
+	*pde = vtop (pt) | PTE_U | PTE_W | PTE_P;
+	invlpg (va & ~HUGE_PGMASK);
+	return true;
+}
+
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
@@ -22,6 +100,11 @@ pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 					return NULL;
 			} else
 				return NULL;
+		} else if (pdp[idx] & PTE_PS) {
+			if (!create)
+				return &pdp[idx];
+			if (!pde_split (&pdp[idx], va))
+				return NULL;
 		}
 		return (uint64_t *) ptov (PTE_ADDR (pdp[idx]) + 8 * PTX (va));
 	}
@@ -60,7 +143,10 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
  * If PML4E does not have a page table for VADDR, behavior depends
  * on CREATE.  If CREATE is true, then a new page table is
  * created and a pointer into it is returned.  Otherwise, a null
- * pointer is returned. */
+ * pointer is returned.
+ * If VADDR lies in a 2 MB page, then without CREATE the page
+ * directory entry mapping it (with PTE_PS set) is returned; with
+ * CREATE the huge page is first split into 4 kB pages. */
 uint64_t *
 pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	uint64_t *pte = NULL;
@@ -88,6 +174,44 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the address of the page directory entry for virtual
+ * address VADDR in page map level 4, pml4, which is where a 2 MB
+ * page covering VADDR is mapped.
+ * If CREATE is true, missing page directory pointer tables and page
+ * directories are created; otherwise, or if memory allocation
+ * fails, a null pointer is returned when one is missing. */
+uint64_t *
+pml4e_walk_pde (uint64_t *pml4e, const uint64_t va, int create) {
+	uint64_t *pdpe, *pde;
+	int allocated = 0;
+
+	if (pml4e == NULL)
+		return NULL;
+	if (!(pml4e[PML4 (va)] & PTE_P)) {
+		uint64_t *new_page = create ? palloc_get_page (PAL_ZERO) : NULL;
+		if (new_page == NULL)
+			return NULL;
+		pml4e[PML4 (va)] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+		allocated = 1;
+	}
+
+	pdpe = ptov (PTE_ADDR (pml4e[PML4 (va)]));
+	if (!(pdpe[PDPE (va)] & PTE_P)) {
+		uint64_t *new_page = create ? palloc_get_page (PAL_ZERO) : NULL;
+		if (new_page == NULL) {
+			if (allocated) {
+				palloc_free_page (pdpe);
+				pml4e[PML4 (va)] = 0;
+			}
+			return NULL;
+		}
+		pdpe[PDPE (va)] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+	}
+
+	pde = ptov (PTE_ADDR (pdpe[PDPE (va)]));
+	return &pde[PDX (va)];
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -117,15 +241,39 @@ pt_for_each (uint64_t *pt, pte_for_each_func *func, void *aux,
 	return true;
 }
 
+/* A 2 MB page is visited as its 4 kB pages.  Each is passed a PTE
+ * built from the page directory entry PDE, with the address of that
+ * 4 kB page and PDE's flags less PTE_PS.  It is a copy, so FUNC's
+ * changes to it are not kept. */
+static bool
+huge_for_each (uint64_t *pde, pte_for_each_func *func, void *aux,
+		unsigned pml4_index, unsigned pdp_index, unsigned pdx_index) {
+	for (unsigned i = 0; i < HUGE_PGCNT; i++) {
+		void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+							 ((uint64_t) pdp_index << PDPESHIFT) |
+							 ((uint64_t) pdx_index << PDXSHIFT) |
+							 ((uint64_t) i << PTXSHIFT));
+		uint64_t pte = (PTE_ADDR (*pde) + ((uint64_t) i << PTXSHIFT))
+			| (*pde & PTE_FLAGS & ~PTE_PS);
+		if (!func (&pte, va, aux))
+			return false;
+	}
+	return true;
+}
+
 static bool
 pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
-					pml4_index, pdp_index, i))
+		if (!(((uint64_t) pte) & PTE_P))
+			continue;
+		if (pdp[i] & PTE_PS) {
+			if (!huge_for_each (&pdp[i], func, aux, pml4_index, pdp_index, i))
 				return false;
+		} else if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
+					pml4_index, pdp_index, i))
+			return false;
 	}
 	return true;
 }
@@ -169,7 +317,11 @@ static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		if (!(((uint64_t) pte) & PTE_P))
+			continue;
+		if (pdp[i] & PTE_PS)
+			palloc_free_multiple ((void *) PTE_ADDR (pte), HUGE_PGCNT);
+		else
 			pt_destroy (PTE_ADDR (pte));
 	}
 	palloc_free_page ((void *) pdp);
@@ -192,6 +344,8 @@ pml4_destroy (uint64_t *pml4) {
 		return;
 	ASSERT (pml4 != base_pml4);
 
+	pcid_forget (pml4);
+
 	/* if PML4 (vaddr) >= 1, it's kernel space by define. */
 	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);
 	if (((uint64_t) pdpe) & PTE_P)
@@ -200,10 +354,31 @@ pml4_destroy (uint64_t *pml4) {
 }
 
 /* Loads page directory PD into the CPU's page directory base
- * register. */
+ * register.  Does nothing if PD is already loaded.  With PCIDs,
+ * entries that PD left in the TLB when it was last switched away
+ * from are kept. */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));
+	uint64_t cr3 = vtop (pml4 ? pml4 : base_pml4);
+	enum intr_level old_level;
+
+	if (PTE_ADDR (rcr3 ()) == cr3)
+		return;
+
+	old_level = intr_disable ();
+	if (pcid_enabled && pml4 != NULL) {
+		unsigned pcid = pcid_of (pml4);
+		if (pcid_owner[pcid] == pml4)
+			cr3 |= CR3_NOFLUSH;
+		pcid_owner[pcid] = pml4;
+		cr3 |= pcid;
+	} else if (pcid_enabled) {
+		/* Kernel mappings never change, so PCID 0 never needs a
+		 * flush. */
+		cr3 |= CR3_NOFLUSH;
+	}
+	lcr3 (cr3);
+	intr_set_level (old_level);
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -216,8 +391,11 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
 
-	if (pte && (*pte & PTE_P))
+	if (pte && (*pte & PTE_P)) {
+		if (is_huge_pte (pte))
+			return ptov (PTE_ADDR (*pte)) + huge_pg_ofs (uaddr);
 		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+	}
 	return NULL;
 }
 
@@ -238,8 +416,12 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, 1);
 
-	if (pte)
+	if (pte) {
+		bool was_present = (*pte & PTE_P) != 0;
 		*pte = vtop (kpage) | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+		if (was_present)
+			tlb_flush_page (pml4, (uint64_t) upage);
+	}
 	return pte != NULL;
 }
 
@@ -255,11 +437,79 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 
 	pte = pml4e_walk (pml4, (uint64_t) upage, false);
 
+	/* Only 4 kB of a 2 MB page goes away, so break it up first. */
+	if (pte != NULL && is_huge_pte (pte)) {
+		if (!pde_split (pte, (uint64_t) upage))
+			PANIC ("pml4_clear_page: out of memory splitting huge page");
+		pte = pml4e_walk (pml4, (uint64_t) upage, false);
+	}
+
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) upage);
+		tlb_flush_page (pml4, (uint64_t) upage);
+	}
+}
+
+/* Adds a mapping in page map level 4 PML4 from the 2 MB user
+ * virtual region starting at UPAGE to the 2 MB physical frame at
+ * kernel virtual address KPAGE, using a single page directory
+ * entry.  UPAGE and the physical address of KPAGE must be multiples
+ * of HUGE_PGSIZE; palloc_get_huge_page() returns suitable frames.
+ * No page in the region may already be mapped.
+ * If WRITABLE is true, the new page is read/write;
+ * otherwise it is read-only.
+ * Returns true if successful, false if memory allocation
+ * failed. */
+bool
+pml4_set_huge_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	ASSERT (huge_pg_ofs (upage) == 0);
+	ASSERT (huge_pg_ofs (vtop (kpage)) == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	uint64_t *pde = pml4e_walk_pde (pml4, (uint64_t) upage, 1);
+	if (pde == NULL)
+		return false;
+
+	/* An empty page table left over from earlier 4 kB mappings is
+	 * no longer needed. */
+	ASSERT (!(*pde & PTE_P) || !(*pde & PTE_PS));
+	if (*pde & PTE_P) {
+		uint64_t *pt = ptov (PTE_ADDR (*pde));
+		for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++)
+			ASSERT (!(pt[i] & PTE_P));
+		palloc_free_page (pt);
 	}
+
+	*pde = vtop (kpage) | PTE_PS | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+	tlb_flush_page (pml4, (uint64_t) upage);
+	return true;
+}
+
+/* Marks the 2 MB user page at UPAGE "not present" in PML4.  Other
+ * bits in the page directory entry are preserved.
+ * UPAGE need not be mapped as a huge page; if it is not, nothing
+ * happens.  Use pml4_clear_page() to unmap part of a huge page. */
+void
+pml4_clear_huge_page (uint64_t *pml4, void *upage) {
+	uint64_t *pde;
+	ASSERT (huge_pg_ofs (upage) == 0);
+	ASSERT (is_user_vaddr (upage));
+
+	pde = pml4e_walk_pde (pml4, (uint64_t) upage, false);
+
+	if (pde != NULL && (*pde & PTE_P) && (*pde & PTE_PS)) {
+		*pde &= ~PTE_P;
+		tlb_flush_page (pml4, (uint64_t) upage);
+	}
+}
+
+/* Returns true if virtual address VADDR in PML4 is mapped by a
+ * 2 MB page. */
+bool
+pml4_is_huge_page (uint64_t *pml4, const void *vaddr) {
+	uint64_t *pde = pml4e_walk_pde (pml4, (uint64_t) vaddr, false);
+	return pde != NULL && (*pde & PTE_P) && (*pde & PTE_PS);
 }
 
 /* Returns true if the PTE for virtual page VPAGE in PML4 is dirty,
@@ -283,8 +533,7 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 		else
 			*pte &= ~(uint32_t) PTE_D;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		tlb_flush_page (pml4, (uint64_t) vpage);
 	}
 }
 
@@ -309,7 +558,6 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 		else
 			*pte &= ~(uint32_t) PTE_A;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		tlb_flush_page (pml4, (uint64_t) vpage);
 	}
 }
@@ -2,14 +2,17 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
-#include "threads/synch.h"
+#include "threads/pte.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -24,13 +27,61 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Within a pool, free pages are managed by a binary buddy
+   allocator.  A free block of order K is 2**K pages long and
+   starts at a page index (relative to the pool base) that is a
+   multiple of 2**K.  Each order has its own list of free blocks,
+   so allocation and freeing take O(log n) time and freed blocks
+   coalesce with their buddies.  The list elements live in a
+   per-page array next to the used_map rather than in the free
+   pages, so the allocator never writes to memory it hands out.
+   The used_map bitmap still records which individual pages are in
+   use.
+
+   Pages are freed from inside the scheduler (see do_schedule() in
+   thread.c), where sleeping on a lock is not allowed, so the free
+   lists are protected by disabling interrupts rather than by a
+   lock.
+
+   On top of the pools, each thread keeps a small magazine of free
+   single pages per pool (see struct palloc_magazine), so that the
+   buddy lists are visited once per batch of PALLOC_MAG_SIZE / 2
+   pages.  A thread updates its magazines with interrupts off, for
+   a pool that runs dry takes back the pages cached in every
+   thread's magazines before it gives up.  Calls made with
+   interrupts off, which includes the scheduler freeing a dead
+   thread's page, bypass the magazines.
+
+   Finally, when nothing else is runnable the idle thread takes
+   free pages out of the buddy lists, clears them, and parks them
+   on the pool's list of zeroed pages (see palloc_zero_free_page()),
+   from which single-page PAL_ZERO requests are served without a
+   memset() on the caller's critical path.  If a pool runs dry, its
+   zeroed pages are handed back to the buddy allocator. */
+
+/* Most pages a pool keeps pre-zeroed. */
+#define PALLOC_ZEROED_MAX 256
+
+/* Number of block orders: the largest block is 2**(PALLOC_ORDER_CNT
+   - 1) pages, i.e. 4 MB. */
+#define PALLOC_ORDER_CNT 11
 
 /* A memory pool. */
 struct pool {
-	struct lock lock;               /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
 	uint8_t *base;                  /* Base of pool. */
+	struct list_elem *links;        /* Per page: free list element. */
+	uint8_t *free_order;            /* Per page: 1 + order of the free block
+	                                   starting there, or 0 if none. */
+	struct list free_list[PALLOC_ORDER_CNT]; /* Free blocks, by order. */
+	size_t free_cnt[PALLOC_ORDER_CNT];       /* Length of each free_list. */
+
+	struct list zeroed_list;        /* Pre-zeroed pages, off the buddy lists. */
+	size_t zeroed_cnt;              /* Length of zeroed_list. */
+	long long zero_hits;            /* PAL_ZERO requests served pre-zeroed. */
+	long long zero_misses;          /* PAL_ZERO requests cleared by memset. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -42,6 +93,15 @@ static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static size_t pool_alloc (struct pool *, size_t page_cnt);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void pool_free (struct pool *, size_t page_idx, size_t page_cnt);
+static struct palloc_magazine *magazine_for (const struct pool *);
+static void magazine_refill (struct pool *, struct palloc_magazine *);
+static void magazines_reclaim (struct pool *);
+static void magazine_drain (struct pool *, struct palloc_magazine *,
+		size_t page_cnt);
+static void *zeroed_get (struct pool *, size_t page_cnt);
 
 /* multiboot info */
 struct multiboot_info {
@@ -223,12 +283,12 @@ split:
 			page_idx = pg_no (start) - pg_no (pool->base);
 			if ((uint64_t) pool_end < end) {
 				page_cnt = ((uint64_t) pool_end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				pool_free (pool, page_idx, page_cnt);
 				start = (uint64_t) pool_end;
 				goto split;
 			} else {
 				page_cnt = ((uint64_t) end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				pool_free (pool, page_idx, page_cnt);
 			}
 		}
 	}
@@ -258,23 +318,36 @@ palloc_init (void) {
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
    then the pages are filled with zeros.  If too few pages are
    available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
+   FLAGS, in which case the kernel panics.  PAGE_CNT may not exceed
+   the largest buddy block, 2**(PALLOC_ORDER_CNT - 1) pages. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	struct palloc_magazine *mag = page_cnt == 1 ? magazine_for (pool) : NULL;
+	void *pages = NULL;
+	bool zeroed = false;
 
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
-	void *pages;
+	if (flags & PAL_ZERO) {
+		pages = zeroed_get (pool, page_cnt);
+		zeroed = pages != NULL;
+	}
 
-	if (page_idx != BITMAP_ERROR)
-		pages = pool->base + PGSIZE * page_idx;
-	else
-		pages = NULL;
+	if (pages != NULL)
+		;
+	else if (mag != NULL) {
+		enum intr_level old_level = intr_disable ();
+		if (mag->cnt == 0)
+			magazine_refill (pool, mag);
+		pages = mag->cnt > 0 ? mag->pages[--mag->cnt] : NULL;
+		intr_set_level (old_level);
+	} else {
+		size_t page_idx = pool_alloc (pool, page_cnt);
+		if (page_idx != BITMAP_ERROR)
+			pages = pool->base + PGSIZE * page_idx;
+	}
 
 	if (pages) {
-		if (flags & PAL_ZERO)
+		if ((flags & PAL_ZERO) && !zeroed)
 			memset (pages, 0, PGSIZE * page_cnt);
 	} else {
 		if (flags & PAL_ASSERT)
@@ -296,6 +369,48 @@ palloc_get_page (enum palloc_flags flags) {
 	return palloc_get_multiple (flags, 1);
 }
 
+/* Obtains a free 2 MB "huge" page, that is, HUGE_PGCNT contiguous
+   pages whose physical address is a multiple of HUGE_PGSIZE, as
+   pml4_set_huge_page() requires, and returns its kernel virtual
+   address.  FLAGS are interpreted as by palloc_get_multiple().
+   Free the page with palloc_free_multiple (page, HUGE_PGCNT). */
+void *
+palloc_get_huge_page (enum palloc_flags flags) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t span, page_idx, head;
+	void *pages = NULL;
+
+	/* Buddy blocks are aligned relative to the pool base, so an
+	   order-9 block is only 2 MB-aligned if the base is.  Otherwise
+	   take a run long enough to contain an aligned huge page and give
+	   back both ends. */
+	span = huge_pg_ofs (vtop (pool->base)) == 0 ? HUGE_PGCNT
+	                                             : 2 * HUGE_PGCNT - 1;
+	page_idx = pool_alloc (pool, span);
+	if (page_idx != BITMAP_ERROR) {
+		uint64_t pa = vtop (pool->base + PGSIZE * page_idx);
+		size_t tail;
+
+		head = (ROUND_UP (pa, HUGE_PGSIZE) - pa) / PGSIZE;
+		tail = span - head - HUGE_PGCNT;
+		if (head > 0)
+			pool_free (pool, page_idx, head);
+		if (tail > 0)
+			pool_free (pool, page_idx + head + HUGE_PGCNT, tail);
+		pages = pool->base + PGSIZE * (page_idx + head);
+	}
+
+	if (pages) {
+		if (flags & PAL_ZERO)
+			memset (pages, 0, HUGE_PGSIZE);
+	} else {
+		if (flags & PAL_ASSERT)
+			PANIC ("palloc_get_huge_page: out of pages");
+	}
+
+	return pages;
+}
+
 /* Frees the PAGE_CNT pages starting at PAGES. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt) {
@@ -319,7 +434,16 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+
+	struct palloc_magazine *mag = page_cnt == 1 ? magazine_for (pool) : NULL;
+	if (mag != NULL) {
+		enum intr_level old_level = intr_disable ();
+		if (mag->cnt == PALLOC_MAG_SIZE)
+			magazine_drain (pool, mag, PALLOC_MAG_SIZE / 2);
+		mag->pages[mag->cnt++] = pages;
+		intr_set_level (old_level);
+	} else
+		pool_free (pool, page_idx, page_cnt);
 }
 
 /* Frees the page at PAGE. */
@@ -335,11 +459,24 @@ init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
      Calculate the space needed for the bitmap
      and subtract it from the pool's size. */
 	uint64_t pgcnt = (end - start) / PGSIZE;
-	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
+	size_t bm_size = ROUND_UP (bitmap_buf_size (pgcnt), sizeof (uint64_t));
+	size_t links_size = pgcnt * sizeof *p->links;
+	size_t bm_pages =
+		DIV_ROUND_UP (bm_size + links_size + pgcnt, PGSIZE) * PGSIZE;
+	int order;
 
-	lock_init(&p->lock);
-	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
+	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_size);
 	p->base = (void *) start;
+	p->links = (struct list_elem *) ((uint8_t *) *bm_base + bm_size);
+	p->free_order = (uint8_t *) *bm_base + bm_size + links_size;
+	memset (p->free_order, 0, pgcnt);
+	for (order = 0; order < PALLOC_ORDER_CNT; order++) {
+		list_init (&p->free_list[order]);
+		p->free_cnt[order] = 0;
+	}
+	list_init (&p->zeroed_list);
+	p->zeroed_cnt = 0;
+	p->zero_hits = p->zero_misses = 0;
 
 	// Mark all to unusable.
 	bitmap_set_all(p->used_map, true);
@@ -356,3 +493,322 @@ page_from_pool (const struct pool *pool, void *page) {
 	size_t end_page = start_page + bitmap_size (pool->used_map);
 	return page_no >= start_page && page_no < end_page;
 }
+
+/* Buddy allocator. */
+
+/* Returns the free list element for page PAGE_IDX in POOL. */
+static inline struct list_elem *
+block_elem (const struct pool *pool, size_t page_idx) {
+	return &pool->links[page_idx];
+}
+
+/* Returns the page index in POOL of the free block whose list
+   element is E. */
+static inline size_t
+elem_page_idx (const struct pool *pool, struct list_elem *e) {
+	return e - pool->links;
+}
+
+/* Puts the free block of 2**ORDER pages at PAGE_IDX on POOL's
+   free lists, without coalescing. */
+static void
+push_block (struct pool *pool, size_t page_idx, int order) {
+	pool->free_order[page_idx] = order + 1;
+	list_push_front (&pool->free_list[order], block_elem (pool, page_idx));
+	pool->free_cnt[order]++;
+}
+
+/* Takes the free block of 2**ORDER pages at PAGE_IDX off POOL's
+   free lists. */
+static void
+remove_block (struct pool *pool, size_t page_idx, int order) {
+	ASSERT (pool->free_order[page_idx] == order + 1);
+	pool->free_order[page_idx] = 0;
+	list_remove (block_elem (pool, page_idx));
+	pool->free_cnt[order]--;
+}
+
+/* Returns the order of the smallest block that holds PAGE_CNT
+   pages, or PALLOC_ORDER_CNT if no block is that large. */
+static int
+order_for (size_t page_cnt) {
+	int order = 0;
+	while (order < PALLOC_ORDER_CNT && ((size_t) 1 << order) < page_cnt)
+		order++;
+	return order;
+}
+
+/* Frees the 2**ORDER pages at PAGE_IDX in POOL, merging them with
+   their buddy for as long as the buddy is also entirely free.
+   Interrupts must be off. */
+static void
+free_block (struct pool *pool, size_t page_idx, int order) {
+	size_t pool_pages = bitmap_size (pool->used_map);
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (page_idx % ((size_t) 1 << order) == 0);
+
+	while (order < PALLOC_ORDER_CNT - 1) {
+		size_t buddy = page_idx ^ ((size_t) 1 << order);
+		if (buddy >= pool_pages || pool->free_order[buddy] != order + 1)
+			break;
+		remove_block (pool, buddy, order);
+		if (buddy < page_idx)
+			page_idx = buddy;
+		order++;
+	}
+	push_block (pool, page_idx, order);
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL's buddy lists and
+   returns the index of the first, or BITMAP_ERROR if no free block
+   is large enough.  The request is rounded up to a whole block, and
+   the pages past PAGE_CNT are given back at once. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt) {
+	int order = order_for (page_cnt);
+	size_t page_idx = BITMAP_ERROR;
+	enum intr_level old_level;
+	int cur;
+
+	if (page_cnt == 0 || order >= PALLOC_ORDER_CNT)
+		return BITMAP_ERROR;
+
+	old_level = intr_disable ();
+	for (cur = order; cur < PALLOC_ORDER_CNT; cur++)
+		if (!list_empty (&pool->free_list[cur]))
+			break;
+	if (cur < PALLOC_ORDER_CNT) {
+		page_idx = elem_page_idx (pool, list_front (&pool->free_list[cur]));
+		remove_block (pool, page_idx, cur);
+
+		/* Split the block, returning the upper halves, until it is
+		   just large enough. */
+		while (cur > order) {
+			cur--;
+			push_block (pool, page_idx + ((size_t) 1 << cur), cur);
+		}
+
+		/* Give back the tail that the request does not use. */
+		size_t block_pages = (size_t) 1 << order;
+		size_t tail = page_idx + page_cnt;
+		while (tail < page_idx + block_pages) {
+			int tail_order = 0;
+			while (tail % ((size_t) 2 << tail_order) == 0
+					&& tail + ((size_t) 2 << tail_order) <= page_idx + block_pages)
+				tail_order++;
+			free_block (pool, tail, tail_order);
+			tail += (size_t) 1 << tail_order;
+		}
+
+		ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+		bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+	}
+	intr_set_level (old_level);
+
+	return page_idx;
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first, or BITMAP_ERROR if there is no such run even
+   after returning the pool's pre-zeroed pages and the pages cached
+   in the threads' magazines to the buddy allocator. */
+static size_t
+pool_alloc (struct pool *pool, size_t page_cnt) {
+	size_t page_idx = buddy_alloc (pool, page_cnt);
+
+	if (page_idx == BITMAP_ERROR && pool->zeroed_cnt > 0) {
+		enum intr_level old_level = intr_disable ();
+		while (!list_empty (&pool->zeroed_list)) {
+			struct list_elem *e = list_pop_front (&pool->zeroed_list);
+			pool->zeroed_cnt--;
+			pool_free (pool, elem_page_idx (pool, e), 1);
+		}
+		intr_set_level (old_level);
+		page_idx = buddy_alloc (pool, page_cnt);
+	}
+	if (page_idx == BITMAP_ERROR) {
+		magazines_reclaim (pool);
+		page_idx = buddy_alloc (pool, page_cnt);
+	}
+	return page_idx;
+}
+
+/* Returns the PAGE_CNT pages starting at PAGE_IDX to POOL.  The
+   range need not be a single block: it is carved into the largest
+   aligned blocks that fit, and each is freed separately. */
+static void
+pool_free (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	enum intr_level old_level = intr_disable ();
+
+	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	while (page_cnt > 0) {
+		int order = 0;
+		while (order < PALLOC_ORDER_CNT - 1
+				&& page_idx % ((size_t) 2 << order) == 0
+				&& ((size_t) 2 << order) <= page_cnt)
+			order++;
+		free_block (pool, page_idx, order);
+		page_idx += (size_t) 1 << order;
+		page_cnt -= (size_t) 1 << order;
+	}
+
+	intr_set_level (old_level);
+}
+
+/* Per-thread magazines. */
+
+/* Returns the running thread's magazine for POOL, or a null
+   pointer if the magazines must not be used right now. */
+static struct palloc_magazine *
+magazine_for (const struct pool *pool) {
+	if (intr_get_level () == INTR_OFF)
+		return NULL;
+	return &thread_current ()->palloc_mags[pool == &user_pool];
+}
+
+/* Moves up to half a magazine's worth of pages from POOL into
+   MAG, which must be empty.  Only the first page may be taken back
+   from other magazines; the rest are taken only if they are free
+   already. */
+static void
+magazine_refill (struct pool *pool, struct palloc_magazine *mag) {
+	enum intr_level old_level = intr_disable ();
+	size_t page_idx;
+
+	ASSERT (mag->cnt == 0);
+	page_idx = pool_alloc (pool, 1);
+	while (page_idx != BITMAP_ERROR) {
+		mag->pages[mag->cnt++] = pool->base + PGSIZE * page_idx;
+		if (mag->cnt == PALLOC_MAG_SIZE / 2)
+			break;
+		page_idx = buddy_alloc (pool, 1);
+	}
+
+	intr_set_level (old_level);
+}
+
+/* Returns the PAGE_CNT most recently cached pages in MAG to
+   POOL. */
+static void
+magazine_drain (struct pool *pool, struct palloc_magazine *mag,
+		size_t page_cnt) {
+	enum intr_level old_level = intr_disable ();
+
+	ASSERT (page_cnt <= mag->cnt);
+	while (page_cnt-- > 0) {
+		void *page = mag->pages[--mag->cnt];
+		pool_free (pool, pg_no (page) - pg_no (pool->base), 1);
+	}
+
+	intr_set_level (old_level);
+}
+
+/* Returns every page that thread T caches from the pool AUX to
+   that pool. */
+static void
+thread_magazine_reclaim (struct thread *t, void *aux) {
+	struct pool *pool = aux;
+	struct palloc_magazine *mag = &t->palloc_mags[pool == &user_pool];
+
+	magazine_drain (pool, mag, mag->cnt);
+}
+
+/* Returns the pages cached in every thread's magazine for POOL to
+   POOL. */
+static void
+magazines_reclaim (struct pool *pool) {
+	enum intr_level old_level = intr_disable ();
+	thread_foreach (thread_magazine_reclaim, pool);
+	intr_set_level (old_level);
+}
+
+/* Returns every page cached in the running thread's magazines to
+   its pool.  Called by a thread that is about to exit. */
+void
+palloc_drain_magazines (void) {
+	struct thread *t = thread_current ();
+
+	magazine_drain (&kernel_pool, &t->palloc_mags[0], t->palloc_mags[0].cnt);
+	magazine_drain (&user_pool, &t->palloc_mags[1], t->palloc_mags[1].cnt);
+}
+
+/* Pre-zeroed pages. */
+
+/* Takes a pre-zeroed page off POOL's list for a PAL_ZERO request
+   of PAGE_CNT pages and returns it, or returns a null pointer if
+   the request must be zeroed by hand.  Counts the hit or miss. */
+static void *
+zeroed_get (struct pool *pool, size_t page_cnt) {
+	enum intr_level old_level = intr_disable ();
+	void *page = NULL;
+
+	if (page_cnt == 1 && !list_empty (&pool->zeroed_list)) {
+		struct list_elem *e = list_pop_front (&pool->zeroed_list);
+		pool->zeroed_cnt--;
+		page = pool->base + PGSIZE * elem_page_idx (pool, e);
+		pool->zero_hits++;
+	} else
+		pool->zero_misses++;
+
+	intr_set_level (old_level);
+	return page;
+}
+
+/* Zeroes one free page and adds it to its pool's list of zeroed
+   pages.  Returns true if a page was zeroed, false if every pool
+   already has PALLOC_ZEROED_MAX zeroed pages or has no free page
+   left.  Called by the idle thread with interrupts on; the page is
+   marked in use while it is being cleared. */
+bool
+palloc_zero_free_page (void) {
+	struct pool *pools[] = { &user_pool, &kernel_pool };
+	size_t i;
+
+	ASSERT (intr_get_level () == INTR_ON);
+
+	for (i = 0; i < sizeof pools / sizeof *pools; i++) {
+		struct pool *pool = pools[i];
+		enum intr_level old_level;
+		size_t page_idx;
+
+		if (pool->zeroed_cnt >= PALLOC_ZEROED_MAX)
+			continue;
+		page_idx = buddy_alloc (pool, 1);
+		if (page_idx == BITMAP_ERROR)
+			continue;
+
+		memset (pool->base + PGSIZE * page_idx, 0, PGSIZE);
+
+		old_level = intr_disable ();
+		list_push_front (&pool->zeroed_list, block_elem (pool, page_idx));
+		pool->zeroed_cnt++;
+		intr_set_level (old_level);
+		return true;
+	}
+	return false;
+}
+
+/* Prints the number of free blocks of each order in POOL. */
+static void
+print_pool_stats (const char *name, const struct pool *pool) {
+	size_t free_pages = 0;
+	int order;
+
+	printf ("Palloc: %s pool blocks free by order:", name);
+	for (order = 0; order < PALLOC_ORDER_CNT; order++) {
+		printf (" %zu", pool->free_cnt[order]);
+		free_pages += pool->free_cnt[order] << order;
+	}
+	printf (" (%zu pages free)\n", free_pages);
+	printf ("Palloc: %s pool %zu pages zeroed, %lld zeroed hits, "
+			"%lld misses\n", name, pool->zeroed_cnt, pool->zero_hits,
+			pool->zero_misses);
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) {
+	print_pool_stats ("kernel", &kernel_pool);
+	print_pool_stats ("user", &user_pool);
+}
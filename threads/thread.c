@@ -29,6 +29,10 @@
 static struct list ready_list;
 static struct list sleep_list;
 
+/* List of all threads.  Threads are added to this list when they
+   are created and removed when they exit. */
+static struct list all_list;
+
 /* Idle thread. */
 static struct thread *idle_thread;
 
@@ -109,6 +113,7 @@ void thread_init(void)
 	list_init(&ready_list);
 	list_init(&sleep_list); // sleep_list 초기화
 	list_init(&destruction_req);
+	list_init(&all_list);
 
 	/* Set up a thread structure for the running thread. */
 	initial_thread = running_thread();
@@ -294,10 +299,12 @@ void thread_exit(void)
 #ifdef USERPROG
 	process_exit();
 #endif
+	palloc_drain_magazines();
 
 	/* Just set our status to dying and schedule another process.
 	   We will be destroyed during the call to schedule_tail(). */
 	intr_disable();
+	list_remove(&thread_current()->all_elem);
 	do_schedule(THREAD_DYING);
 	NOT_REACHED();
 }
@@ -451,6 +458,17 @@ idle(void *idle_started_ UNUSED)
 		intr_disable();
 		thread_block();
 
+		/* Nothing else is runnable, so spend the time clearing free
+		   pages for later PAL_ZERO allocations.  The ready list is
+		   checked between pages, so a thread woken by an interrupt
+		   waits for at most one page to be cleared. */
+		intr_enable();
+		while (list_empty(&ready_list) && palloc_zero_free_page())
+			continue;
+		intr_disable();
+		if (!list_empty(&ready_list))
+			continue;
+
 		/* Re-enable interrupts and wait for the next one.
 
 		   The `sti' instruction disables interrupts until the
@@ -507,6 +525,23 @@ init_thread(struct thread *t, const char *name, int priority)
 	sema_init(&t->exit_sema, 0);
 	sema_init(&t->wait_sema, 0);
 	list_init(&(t->child_list));
+
+	enum intr_level old_level = intr_disable();
+	list_push_back(&all_list, &t->all_elem);
+	intr_set_level(old_level);
+}
+
+/* Invokes FUNC on all threads, passing along AUX.  Must be called
+   with interrupts off. */
+void thread_foreach(thread_action_func *func, void *aux)
+{
+	struct list_elem *e;
+
+	ASSERT(intr_get_level() == INTR_OFF);
+
+	for (e = list_begin(&all_list); e != list_end(&all_list);
+		 e = list_next(e))
+		func(list_entry(e, struct thread, all_elem), aux);
 }
 
 /* Chooses and returns the next thread to be scheduled.  Should
@@ -10,9 +10,11 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
@@ -176,13 +178,16 @@ __do_fork(void *aux)
 	if_.R.rax = 0; // 자식 프로세스의 리턴값은 0
 
 	/* 2. Duplicate PT */
+#ifdef VM
+	/* Before anything can fail, so that process_cleanup() may kill it. */
+	supplemental_page_table_init(&current->spt);
+#endif
 	current->pml4 = pml4_create();
 	if (current->pml4 == NULL)
 		goto error;
 
 	process_activate(current);
 #ifdef VM
-	supplemental_page_table_init(&current->spt);
 	if (!supplemental_page_table_copy(&current->spt, &parent->spt))
 		goto error;
 #else
@@ -379,7 +384,10 @@ process_cleanup(void)
 	struct thread *curr = thread_current();
 
 #ifdef VM
-	supplemental_page_table_kill(&curr->spt);
+	/* Only a thread with a page directory has ever had its
+	 * supplemental page table set up. */
+	if (curr->pml4 != NULL)
+		supplemental_page_table_kill(&curr->spt);
 #endif
 
 	uint64_t *pml4;
@@ -405,13 +413,72 @@ process_cleanup(void)
  * This function is called on every context switch. */
 void process_activate(struct thread *next)
 {
-	/* Activate thread's page tables. */
-	pml4_activate(next->pml4);
+	/* Activate thread's page tables.  A kernel thread never touches
+	 * user memory, so it simply keeps whichever address space is
+	 * loaded (lazy TLB); switching back to that process then costs
+	 * no CR3 load at all. */
+	if (next->pml4 != NULL)
+		pml4_activate(next->pml4);
 
 	/* Set thread's kernel stack for use in processing interrupts. */
 	tss_update(next);
 }
 
+// 파일 객체에 대한 파일 디스크립터를 생성하는 함수
+int process_add_file(struct file *f)
+{
+	struct thread *curr = thread_current();
+	struct file **fdt = curr->fdt;
+
+	// limit을 넘지 않는 범위 안에서 빈 자리 탐색
+	while (curr->next_fd < FDT_COUNT_LIMIT && fdt[curr->next_fd])
+		curr->next_fd++;
+	if (curr->next_fd >= FDT_COUNT_LIMIT)
+		return -1;
+	fdt[curr->next_fd] = f;
+
+	return curr->next_fd;
+}
+
+// 파일 객체를 검색하는 함수
+struct file *process_get_file(int fd)
+{
+	struct thread *curr = thread_current();
+	struct file **fdt = curr->fdt;
+	/* 파일 디스크립터에 해당하는 파일 객체를 리턴 */
+	/* 없을 시 NULL 리턴 */
+	if (fd < 2 || fd >= FDT_COUNT_LIMIT)
+		return NULL;
+	return fdt[fd];
+}
+
+// 파일 디스크립터 테이블에서 파일 객체를 제거하는 함수
+void process_close_file(int fd)
+{
+	struct thread *curr = thread_current();
+	struct file **fdt = curr->fdt;
+	if (fd < 2 || fd >= FDT_COUNT_LIMIT)
+		return NULL;
+	fdt[fd] = NULL;
+}
+
+// 자식 리스트에서 원하는 프로세스를 검색하는 함수
+struct thread *get_child_process(int pid)
+{
+	/* 자식 리스트에 접근하여 프로세스 디스크립터 검색 */
+	struct thread *cur = thread_current();
+	struct list *child_list = &cur->child_list;
+	for (struct list_elem *e = list_begin(child_list); e != list_end(child_list); e = list_next(e))
+	{
+		struct thread *t = list_entry(e, struct thread, child_elem);
+		/* 해당 pid가 존재하면 프로세스 디스크립터 반환 */
+		if (t->tid == pid)
+			return t;
+	}
+	/* 리스트에 존재하지 않으면 NULL 리턴 */
+	return NULL;
+}
+
 /* We load ELF binaries.  The following definitions are taken
  * from the ELF specification, [ELF1], more-or-less verbatim.  */
 
@@ -742,61 +809,6 @@ install_page(void *upage, void *kpage, bool writable)
 	return (pml4_get_page(t->pml4, upage) == NULL && pml4_set_page(t->pml4, upage, kpage, writable));
 }
 
-// 파일 객체에 대한 파일 디스크립터를 생성하는 함수
-int process_add_file(struct file *f)
-{
-	struct thread *curr = thread_current();
-	struct file **fdt = curr->fdt;
-
-	// limit을 넘지 않는 범위 안에서 빈 자리 탐색
-	while (curr->next_fd < FDT_COUNT_LIMIT && fdt[curr->next_fd])
-		curr->next_fd++;
-	if (curr->next_fd >= FDT_COUNT_LIMIT)
-		return -1;
-	fdt[curr->next_fd] = f;
-
-	return curr->next_fd;
-}
-
-// 파일 객체를 검색하는 함수
-struct file *process_get_file(int fd)
-{
-	struct thread *curr = thread_current();
-	struct file **fdt = curr->fdt;
-	/* 파일 디스크립터에 해당하는 파일 객체를 리턴 */
-	/* 없을 시 NULL 리턴 */
-	if (fd < 2 || fd >= FDT_COUNT_LIMIT)
-		return NULL;
-	return fdt[fd];
-}
-
-// 파일 디스크립터 테이블에서 파일 객체를 제거하는 함수
-void process_close_file(int fd)
-{
-	struct thread *curr = thread_current();
-	struct file **fdt = curr->fdt;
-	if (fd < 2 || fd >= FDT_COUNT_LIMIT)
-		return NULL;
-	fdt[fd] = NULL;
-}
-
-// 자식 리스트에서 원하는 프로세스를 검색하는 함수
-struct thread *get_child_process(int pid)
-{
-	/* 자식 리스트에 접근하여 프로세스 디스크립터 검색 */
-	struct thread *cur = thread_current();
-	struct list *child_list = &cur->child_list;
-	for (struct list_elem *e = list_begin(child_list); e != list_end(child_list); e = list_next(e))
-	{
-		struct thread *t = list_entry(e, struct thread, child_elem);
-		/* 해당 pid가 존재하면 프로세스 디스크립터 반환 */
-		if (t->tid == pid)
-			return t;
-	}
-	/* 리스트에 존재하지 않으면 NULL 리턴 */
-	return NULL;
-}
-
 #else
 /* From here, codes will be used after project 3.
  * If you want to implement the function for only project 2, implement it on the
@@ -805,9 +817,12 @@ struct thread *get_child_process(int pid)
 static bool
 lazy_load_segment(struct page *page, void *aux)
 {
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
+	/* AUX says which part of the executable the page holds. */
+	struct file_load_info *info = aux;
+	bool success = file_load_info_read(info, page->frame->kva);
+
+	file_load_info_free(info);
+	return success;
 }
 
 /* Loads a segment starting at offset OFS in FILE at address
@@ -832,6 +847,13 @@ load_segment(struct file *file, off_t ofs, uint8_t *upage,
 	ASSERT(pg_ofs(upage) == 0);
 	ASSERT(ofs % PGSIZE == 0);
 
+	/* Keep mmap() off the segment.  Its pages all read the executable
+	 * through the region's handle. */
+	struct vm_region *region = vm_reserve_region(VM_REGION_SEGMENT, upage,
+												 upage + read_bytes + zero_bytes, file);
+	if (region == NULL)
+		return false;
+
 	while (read_bytes > 0 || zero_bytes > 0)
 	{
 		/* Do calculate how to fill this page.
@@ -840,16 +862,47 @@ load_segment(struct file *file, off_t ofs, uint8_t *upage,
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		void *aux = NULL;
-		if (!vm_alloc_page_with_initializer(VM_ANON, upage,
-											writable, lazy_load_segment, aux))
+		/* A page of nothing but zeros needs nothing from the file. */
+		if (page_read_bytes == 0)
+		{
+			if (!vm_alloc_page(VM_ANON, upage, writable))
+				return false;
+			zero_bytes -= page_zero_bytes;
+			upage += PGSIZE;
+			continue;
+		}
+
+		/* A read-only page that holds a whole page of the file, or all
+		 * the rest of it, is shared through the page cache by every
+		 * process running the executable.  While it runs, write() to it
+		 * is denied and do_mmap() refuses writable mappings of it.  A
+		 * writable mapping made before it was loaded stores into the
+		 * page cache directly, though, so then each process reads in a
+		 * copy of its own. */
+		bool shared = !writable
+			&& (page_read_bytes == PGSIZE
+				|| ofs + (off_t)page_read_bytes == file_length(file))
+			&& !inode_mapped_writable(file_get_inode(file));
+
+		struct file_load_info *aux = malloc(sizeof *aux);
+		if (aux == NULL)
 			return false;
+		aux->file = region->file;
+		aux->ofs = ofs;
+		aux->read_bytes = page_read_bytes;
+		aux->region = region;
+		if (!vm_alloc_page_with_initializer(shared ? VM_FILE : VM_ANON, upage,
+											writable, shared ? file_lazy_load : lazy_load_segment, aux))
+		{
+			file_load_info_free(aux);
+			return false;
+		}
 
 		/* Advance. */
 		read_bytes -= page_read_bytes;
 		zero_bytes -= page_zero_bytes;
 		upage += PGSIZE;
+		ofs += page_read_bytes;
 	}
 	return true;
 }
@@ -861,10 +914,14 @@ setup_stack(struct intr_frame *if_)
 	bool success = false;
 	void *stack_bottom = (void *)(((uint8_t *)USER_STACK) - PGSIZE);
 
-	/* TODO: Map the stack on stack_bottom and claim the page immediately.
-	 * TODO: If success, set the rsp accordingly.
-	 * TODO: You should mark the page is stack. */
-	/* TODO: Your code goes here */
+	/* The stack may grow to fill the region, and nothing else may be
+	 * mapped there. */
+	if (!vm_reserve_region(VM_REGION_STACK, (uint8_t *)USER_STACK - VM_STACK_LIMIT, (void *)USER_STACK, NULL))
+		return false;
+	if (vm_alloc_page(VM_ANON | VM_STACK, stack_bottom, true))
+		success = vm_claim_page(stack_bottom);
+	if (success)
+		if_->rsp = USER_STACK;
 
 	return success;
 }
@@ -14,6 +14,9 @@
 #include "devices/input.h"
 #include "lib/kernel/stdio.h"
 #include "threads/palloc.h"
+#ifdef VM
+#include "vm/vm.h"
+#endif
 
 void syscall_entry(void);
 void syscall_handler(struct intr_frame *);
@@ -32,6 +35,14 @@ void close(int fd);
 tid_t fork(const char *thread_name, struct intr_frame *f);
 int exec(const char *cmd_line);
 int wait(int pid);
+#ifdef VM
+void *mmap(void *addr, size_t length, int writable, int fd, off_t offset);
+void munmap(void *addr);
+int madvise(void *addr, size_t length, int advice);
+#endif
+
+/* Serializes file system operations. */
+struct lock filesys_lock;
 
 /* System call.
  *
@@ -64,6 +75,10 @@ void syscall_init(void)
 void syscall_handler(struct intr_frame *f UNUSED)
 {
 	int syscall_n = f->R.rax; /* 시스템 콜 넘버 */
+#ifdef VM
+	/* Page faults in the kernel need this to recognize stack growth. */
+	thread_current()->user_rsp = (void *)f->rsp;
+#endif
 	switch (syscall_n)
 	{
 	case SYS_HALT:
@@ -107,6 +122,18 @@ void syscall_handler(struct intr_frame *f UNUSED)
 		break;
 	case SYS_CLOSE:
 		close(f->R.rdi);
+		break;
+#ifdef VM
+	case SYS_MMAP:
+		f->R.rax = (uint64_t)mmap((void *)f->R.rdi, f->R.rsi, f->R.rdx, f->R.r10, f->R.r8);
+		break;
+	case SYS_MUNMAP:
+		munmap((void *)f->R.rdi);
+		break;
+	case SYS_MADVISE:
+		f->R.rax = madvise((void *)f->R.rdi, f->R.rsi, f->R.rdx);
+		break;
+#endif
 	}
 }
 
@@ -116,9 +143,38 @@ void check_address(void *addr)
 		exit(-1);
 	if (!is_user_vaddr(addr))
 		exit(-1);
+#ifdef VM
+	/* Pages are loaded on first touch, so ADDR only has to belong to
+	 * the process, or be where the stack may grow to. */
+	struct thread *curr = thread_current();
+	if (spt_find_page(&curr->spt, addr) == NULL && !vm_is_stack_access(addr, curr->user_rsp))
+		exit(-1);
+#else
 	if (pml4_get_page(thread_current()->pml4, addr) == NULL)
 		exit(-1);
+#endif
+}
+
+#ifdef VM
+/* Exits if any page of the user buffer of SIZE bytes at ADDR is one
+ * the kernel may not write, before any lock is taken. */
+static void
+check_writable(void *addr, size_t size)
+{
+	struct thread *curr = thread_current();
+	uint8_t *upage;
+
+	if (size == 0)
+		return;
+	for (upage = pg_round_down(addr); upage <= (uint8_t *)addr + size - 1;
+		 upage += PGSIZE)
+	{
+		struct page *page = spt_find_page(&curr->spt, upage);
+		if (page != NULL && !page->writable)
+			exit(-1);
+	}
 }
+#endif
 
 void halt(void)
 {
@@ -130,6 +186,10 @@ void exit(int status)
 	struct thread *curr = thread_current();
 	curr->exit_status = status; // 이거 wait에서 사용?
 	printf("%s: exit(%d)\n", curr->name, status);
+	/* A bad user pointer may fault in the kernel in the middle of a
+	 * file system call. */
+	if (lock_held_by_current_thread(&filesys_lock))
+		lock_release(&filesys_lock);
 	thread_exit();
 }
 
@@ -192,6 +252,9 @@ void close(int fd)
 int read(int fd, void *buffer, unsigned size)
 {
 	check_address(buffer);
+#ifdef VM
+	check_writable(buffer, size);
+#endif
 
 	char *ptr = (char *)buffer;
 	int bytes_read = 0;
@@ -281,3 +344,25 @@ int wait(int pid)
 {
 	return process_wait(pid);
 }
+
+#ifdef VM
+void *mmap(void *addr, size_t length, int writable, int fd, off_t offset)
+{
+	struct file *file = process_get_file(fd);
+	if (file == NULL)
+		return NULL;
+	return do_mmap(addr, length, writable, file, offset);
+}
+
+void munmap(void *addr)
+{
+	do_munmap(addr);
+}
+
+int madvise(void *addr, size_t length, int advice)
+{
+	if (advice < VM_ADVICE_NORMAL || advice > VM_ADVICE_DONTNEED)
+		return -1;
+	return vm_madvise(addr, length, advice) ? 0 : -1;
+}
+#endif
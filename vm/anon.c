@@ -1,7 +1,13 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
+#include <bitmap.h>
+#include <string.h>
 #include "vm/vm.h"
+#include "vm/ksm.h"
+#include "vm/zswap.h"
 #include "devices/disk.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -17,36 +23,112 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+/* The swap disk is divided into page-sized slots; swap_slots has a
+ * bit per slot that is set while a page occupies it. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+static struct bitmap *swap_slots;
+static struct lock swap_lock;
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	swap_disk = disk_get (1, 1);
+	swap_slots = swap_disk != NULL
+		? bitmap_create (disk_size (swap_disk) / SECTORS_PER_SLOT) : NULL;
+	lock_init (&swap_lock);
+	zswap_init ();
 }
 
 /* Initialize the file mapping */
 bool
-anon_initializer (struct page *page, enum vm_type type, void *kva) {
+anon_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->swap_slot = BITMAP_ERROR;
+	anon_page->zswap_idx = BITMAP_ERROR;
+	anon_page->ksm = NULL;
+	return true;
+}
+
+/* Frees SLOT for reuse. */
+static void
+swap_slot_free (size_t slot) {
+	lock_acquire (&swap_lock);
+	bitmap_reset (swap_slots, slot);
+	lock_release (&swap_lock);
 }
 
-/* Swap in the page by read contents from the swap disk. */
+/* Swap in the page by read contents from the compressed store or
+ * the swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+
+	if (anon_page->zswap_idx != BITMAP_ERROR) {
+		zswap_load (anon_page->zswap_idx, anon_page->zswap_len, kva);
+		anon_page->zswap_idx = BITMAP_ERROR;
+		return true;
+	}
+	if (anon_page->swap_slot == BITMAP_ERROR) {
+		memset (kva, 0, PGSIZE);
+		return true;
+	}
+
+	disk_read_multiple (swap_disk, anon_page->swap_slot * SECTORS_PER_SLOT,
+			SECTORS_PER_SLOT, kva);
+	swap_slot_free (anon_page->swap_slot);
+	anon_page->swap_slot = BITMAP_ERROR;
+	return true;
 }
 
-/* Swap out the page by writing contents to the swap disk. */
+/* Swap out the page by compressing it into memory or, failing that,
+ * writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+	size_t slot;
+
+	if (zswap_store (page->frame->kva, &anon_page->zswap_idx,
+				&anon_page->zswap_len))
+		return true;
+	if (swap_slots == NULL)
+		return false;
+
+	/* Next fit keeps the victims of one eviction pass in adjacent
+	 * slots, so they are written out in one sweep of the disk. */
+	lock_acquire (&swap_lock);
+	slot = bitmap_scan_and_flip_next (swap_slots, 1, false);
+	lock_release (&swap_lock);
+	if (slot == BITMAP_ERROR)
+		return false;
+
+	disk_write_multiple (swap_disk, slot * SECTORS_PER_SLOT,
+			SECTORS_PER_SLOT, page->frame->kva);
+	anon_page->swap_slot = slot;
+	return true;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+	void *kva;
+
+	/* A merged page only holds a reference to the merged page. */
+	if (anon_page->ksm != NULL) {
+		vm_frame_unshare (page);
+		ksm_put (anon_page->ksm);
+		return;
+	}
+
+	kva = vm_frame_detach (page);
+	if (kva != NULL)
+		palloc_free_page (kva);
+	if (anon_page->swap_slot != BITMAP_ERROR)
+		swap_slot_free (anon_page->swap_slot);
+	if (anon_page->zswap_idx != BITMAP_ERROR)
+		zswap_free (anon_page->zswap_idx, anon_page->zswap_len);
 }
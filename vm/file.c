@@ -1,6 +1,13 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
+#include <round.h>
+#include <string.h>
 #include "vm/vm.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/vaddr.h"
+#include "userprog/syscall.h"
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
@@ -17,42 +24,286 @@ static const struct page_operations file_ops = {
 /* The initializer of file vm */
 void
 vm_file_init (void) {
+	page_cache_init ();
 }
 
 /* Initialize the file backed page */
 bool
-file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
+file_backed_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &file_ops;
 
 	struct file_page *file_page = &page->file;
+	file_page->region = NULL;
+	file_page->file = NULL;
+	file_page->cache = NULL;
+	return true;
+}
+
+/* Reads READ_BYTES bytes of FILE at OFS into the page at KVA and
+ * zeroes the rest of it.  Page faults inside read() and write()
+ * reach here with the file system lock already held. */
+static bool
+page_read (struct file *file, off_t ofs, size_t read_bytes, void *kva) {
+	bool locked = !lock_held_by_current_thread (&filesys_lock);
+	bool ok;
+
+	if (locked)
+		lock_acquire (&filesys_lock);
+	ok = file_read_at (file, kva, read_bytes, ofs) == (off_t) read_bytes;
+	if (locked)
+		lock_release (&filesys_lock);
+
+	memset ((uint8_t *) kva + read_bytes, 0, PGSIZE - read_bytes);
+	return ok;
+}
+
+/* Reads the data INFO describes into the page at KVA. */
+bool
+file_load_info_read (const struct file_load_info *info, void *kva) {
+	return page_read (info->file, info->ofs, info->read_bytes, kva);
+}
+
+/* Initializer for file-backed pages: records where the page lives in
+ * the file.  The data is read in by the page cache.  Consumes AUX, a
+ * struct file_load_info. */
+bool
+file_lazy_load (struct page *page, void *aux) {
+	struct file_load_info *info = aux;
+	struct file_page *file_page = &page->file;
+
+	file_page->region = info->region;
+	file_page->file = info->file;
+	file_page->ofs = info->ofs;
+	file_page->read_bytes = info->read_bytes;
+	free (info);
+	return true;
+}
+
+/* Claims PAGE, an mmap()ed page that may not be initialized yet, by
+ * mapping the page cache's frame for its data.  Evicts another page
+ * if needed only if EVICT is true. */
+bool
+file_backed_claim (struct page *page, bool evict) {
+	struct file_page *file_page = &page->file;
+
+	if (VM_TYPE (page->operations->type) == VM_UNINIT
+			&& !swap_in (page, NULL))
+		return false;
+
+	if (file_page->cache == NULL) {
+		file_page->cache = page_cache_get (file_get_inode (file_page->file),
+				file_page->ofs);
+		if (file_page->cache == NULL)
+			return false;
+	}
+	return vm_frame_share (page, file_page->cache, evict);
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+
+	return page_read (file_page->file, file_page->ofs, file_page->read_bytes,
+			kva);
 }
 
-/* Swap out the page by writeback contents to the file. */
+/* Swap out the page by writeback contents to the file.  mmap()ed
+ * pages only map frames of the page cache, which does the writing
+ * back, and never own one. */
 static bool
-file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+file_backed_swap_out (struct page *page UNUSED) {
+	return false;
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+
+	if (file_page->cache != NULL) {
+		page_cache_unmap (page, file_page->cache);
+		page_cache_put (file_page->cache);
+	}
+}
+
+/* Returns the region of SPT mapped at ADDR, or a null pointer. */
+static struct mmap_region *
+mmap_find (struct supplemental_page_table *spt, void *addr) {
+	struct vm_region *region = spt_find_region (spt, addr,
+			(uint8_t *) addr + 1);
+
+	if (region == NULL || region->type != VM_REGION_MMAP
+			|| ((struct mmap_region *) region)->addr != addr)
+		return NULL;
+	return (struct mmap_region *) region;
+}
+
+/* Removes REGION and all of its pages from SPT, writing modified
+ * pages back to the file. */
+void
+file_mmap_remove (struct supplemental_page_table *spt,
+		struct mmap_region *region) {
+	size_t i;
+
+	for (i = 0; i < region->page_cnt; i++) {
+		struct page *page = spt_find_page (spt,
+				(uint8_t *) region->addr + i * PGSIZE);
+		if (page != NULL)
+			spt_remove_page (spt, page);
+	}
+	spt_remove_region (spt, &region->base);
+	if (region->writable)
+		inode_unmap_writable (file_get_inode (region->base.file));
+	file_close (region->base.file);
+	free (region);
 }
 
 /* Do the mmap */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct mmap_region *region;
+	off_t file_len;
+	size_t page_cnt, i;
+
+	if (addr == NULL || pg_ofs (addr) != 0 || offset < 0
+			|| offset % PGSIZE != 0 || length == 0)
+		return NULL;
+	if ((uint8_t *) addr + length < (uint8_t *) addr
+			|| !is_user_vaddr ((uint8_t *) addr + length - 1))
+		return NULL;
+	file_len = file_length (file);
+	if (file_len == 0)
+		return NULL;
+
+	/* The mapping would store into the page cache's frames, which a
+	 * running executable shares as its code. */
+	if (writable && inode_write_denied (file_get_inode (file)))
+		return NULL;
+
+	/* The new region may not overlap the code, data, stack or any
+	 * other mapping. */
+	page_cnt = DIV_ROUND_UP (length, PGSIZE);
+	region = malloc (sizeof *region);
+	if (region == NULL)
+		return NULL;
+	if (!spt_add_region (spt, &region->base, VM_REGION_MMAP, addr,
+				(uint8_t *) addr + page_cnt * PGSIZE)) {
+		free (region);
+		return NULL;
+	}
+	region->addr = addr;
+	region->page_cnt = 0;
+	region->writable = false;
+	region->base.file = file_reopen (file);
+	if (region->base.file == NULL) {
+		file_mmap_remove (spt, region);
+		return NULL;
+	}
+	if (writable) {
+		region->writable = true;
+		inode_map_writable (file_get_inode (region->base.file));
+	}
+
+	for (i = 0; i < page_cnt; i++) {
+		struct file_load_info *info = malloc (sizeof *info);
+		off_t ofs = offset + i * PGSIZE;
+
+		if (info == NULL) {
+			file_mmap_remove (spt, region);
+			return NULL;
+		}
+		info->file = region->base.file;
+		info->ofs = ofs;
+		info->read_bytes = ofs >= file_len ? 0
+			: file_len - ofs < PGSIZE ? (size_t) (file_len - ofs) : PGSIZE;
+		info->region = &region->base;
+		if (!vm_alloc_page_with_initializer (VM_FILE,
+					(uint8_t *) addr + i * PGSIZE, writable, file_lazy_load,
+					info)) {
+			free (info);
+			file_mmap_remove (spt, region);
+			return NULL;
+		}
+		region->page_cnt++;
+	}
+	return addr;
 }
 
 /* Do the munmap */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct mmap_region *region = mmap_find (spt, addr);
+
+	if (region != NULL)
+		file_mmap_remove (spt, region);
+}
+
+/* Returns a copy of INFO for a page of the current process, whose
+ * table is DST, or a null pointer if memory runs out.  The regions
+ * must already have been copied to DST; the copy shares the file of
+ * the one at the same address. */
+struct file_load_info *
+file_load_info_copy (struct supplemental_page_table *dst,
+		const struct file_load_info *info) {
+	struct file_load_info *copy = malloc (sizeof *copy);
+	void *start = (void *) info->region->elem.start;
+
+	if (copy == NULL)
+		return NULL;
+	*copy = *info;
+	copy->region = spt_find_region (dst, start, (uint8_t *) start + 1);
+	copy->file = copy->region->file;
+	return copy;
+}
+
+/* Returns load information for a copy in DST of the resident or
+ * evicted file-backed PAGE, or a null pointer if memory runs out. */
+struct file_load_info *
+file_page_load_info (struct supplemental_page_table *dst, struct page *page) {
+	struct file_load_info info = {
+		.file = page->file.file,
+		.ofs = page->file.ofs,
+		.read_bytes = page->file.read_bytes,
+		.region = page->file.region,
+	};
+	return file_load_info_copy (dst, &info);
+}
+
+/* Frees INFO, which may be null. */
+void
+file_load_info_free (struct file_load_info *info) {
+	free (info);
+}
+
+/* Gives DST a copy of REGION, an mmap() region of another process,
+ * without any pages yet. */
+bool
+file_mmap_copy (struct supplemental_page_table *dst,
+		const struct mmap_region *region) {
+	struct mmap_region *copy = malloc (sizeof *copy);
+
+	if (copy == NULL)
+		return false;
+	if (!spt_add_region (dst, &copy->base, VM_REGION_MMAP, region->addr,
+				(uint8_t *) region->addr + region->page_cnt * PGSIZE)) {
+		free (copy);
+		return false;
+	}
+	copy->addr = region->addr;
+	copy->page_cnt = region->page_cnt;
+	copy->writable = false;
+	copy->base.file = file_reopen (region->base.file);
+	if (copy->base.file == NULL)
+		return false;
+	if (region->writable) {
+		copy->writable = true;
+		inode_map_writable (file_get_inode (copy->base.file));
+	}
+	return true;
 }
@@ -0,0 +1,253 @@
+/* ksm.c: Merging of identical anonymous pages.
+ *
+ * Once a second, a kernel thread walks the frame table and
+ * checksums every anonymous frame that has not been written since
+ * the previous walk.  A frame whose checksum matches a merged page
+ * is merged into it; one that matches another frame seen in the same
+ * walk is turned into a new merged page and the other is merged
+ * into that.  Merging compares the full contents with memcmp() and
+ * leaves the pages mapping one read-only frame, which belongs to a
+ * page of no process.  A write to such a page gives it a copy of
+ * its own again; see vm_handle_wp(). */
+
+#include "vm/ksm.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "threads/mmu.h"
+#include "vm/vm.h"
+
+/* Timer ticks between walks of the frame table. */
+#define KSM_SCAN_TICKS TIMER_FREQ
+
+/* A merged page: an anonymous page that no process maps itself,
+ * whose frame the merged process pages map read-only. */
+struct ksm_page {
+	struct page page;           /* Owns the shared frame. */
+	uint64_t checksum;          /* Checksum of the contents. */
+	size_t ref_cnt;             /* Number of pages merged into it. */
+	struct hash_elem elem;      /* Element in merged_pages. */
+};
+
+/* A frame seen during the current walk that matched nothing. */
+struct ksm_candidate {
+	uint64_t checksum;
+	struct page *page;          /* Anonymous page owning the frame. */
+	struct hash_elem elem;
+};
+
+static struct hash merged_pages;        /* struct ksm_page by checksum. */
+static struct lock ksm_lock;            /* Protects merged_pages. */
+static bool ksm_started;
+
+/* Statistics. */
+static size_t ksm_shared;               /* Number of merged pages. */
+static size_t ksm_saved;                /* Frames freed by merging. */
+
+static hash_hash_func ksm_page_hash, candidate_hash;
+static hash_less_func ksm_page_less, candidate_less;
+static void ksm_thread (void *aux);
+
+/* Initializes the page merger. */
+void
+ksm_init (void) {
+	hash_init (&merged_pages, ksm_page_hash, ksm_page_less, NULL);
+	lock_init (&ksm_lock);
+}
+
+/* Starts the thread that merges pages, unless it already runs.
+ * There is nothing to merge until the first process starts. */
+void
+ksm_start (void) {
+	if (!ksm_started) {
+		ksm_started = true;
+		thread_create ("ksm", PRI_DEFAULT, ksm_thread, NULL);
+	}
+}
+
+/* Drops the reference of a page that no longer maps merged page
+ * KSM, freeing it once no page does.  Must not be called with
+ * frame_lock held. */
+void
+ksm_put (struct page *ksm) {
+	struct ksm_page *k = (struct ksm_page *) ksm;
+	bool last;
+
+	lock_acquire (&ksm_lock);
+	last = --k->ref_cnt == 0;
+	if (last) {
+		hash_delete (&merged_pages, &k->elem);
+		ksm_shared--;
+	} else
+		ksm_saved--;
+	lock_release (&ksm_lock);
+
+	if (last)
+		vm_dealloc_page (ksm);
+}
+
+/* Prints merging statistics. */
+void
+ksm_print_stats (void) {
+	if (ksm_started)
+		printf ("KSM: %zu merged pages, %zu pages saved\n",
+				ksm_shared, ksm_saved);
+}
+
+/* Returns a checksum of the page at KVA. */
+static uint64_t
+page_checksum (const void *kva) {
+	const uint64_t *word = kva;
+	uint64_t sum = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < PGSIZE / sizeof *word; i++)
+		sum = (sum ^ word[i]) * 0x100000001b3ULL;
+	return sum;
+}
+
+/* Returns a new merged page with checksum SUM, not yet holding a
+ * frame, or a null pointer if memory runs out. */
+static struct ksm_page *
+ksm_page_create (uint64_t sum) {
+	struct ksm_page *k = malloc (sizeof *k);
+
+	if (k == NULL)
+		return NULL;
+	k->page = (struct page) { .va = NULL };
+	anon_initializer (&k->page, VM_ANON, NULL);
+	k->checksum = sum;
+	k->ref_cnt = 0;
+	return k;
+}
+
+/* Looks for a frame with the same contents as FRAME and merges the
+ * two.  Called by vm_frame_walk() with frame_lock held.  CANDIDATES
+ * holds the frames seen earlier in this walk that matched nothing. */
+static void
+ksm_scan_frame (struct frame *frame, void *candidates_) {
+	struct hash *candidates = candidates_;
+	struct page *page = frame->page;
+	struct ksm_candidate key, *c;
+	struct ksm_page k_key, *k;
+	struct hash_elem *e;
+	uint64_t *pml4;
+
+	if (frame->pinned || frame->loading || page == NULL || page->owner == NULL
+			|| VM_TYPE (page->operations->type) != VM_ANON
+			|| page->anon.ksm != NULL)
+		return;
+
+	/* Leave alone pages written since the previous walk: they are
+	 * likely to be written again soon. */
+	pml4 = page->owner->pml4;
+	if (pml4_is_dirty (pml4, page->va)) {
+		pml4_set_dirty (pml4, page->va, false);
+		return;
+	}
+
+	key.checksum = k_key.checksum = page_checksum (frame->kva);
+	lock_acquire (&ksm_lock);
+	e = hash_find (&merged_pages, &k_key.elem);
+	if (e != NULL) {
+		k = hash_entry (e, struct ksm_page, elem);
+		if (k->page.frame != NULL && vm_frame_merge (&k->page, page)) {
+			k->ref_cnt++;
+			ksm_saved++;
+		}
+		lock_release (&ksm_lock);
+		return;
+	}
+
+	e = hash_find (candidates, &key.elem);
+	if (e != NULL) {
+		c = hash_entry (e, struct ksm_candidate, elem);
+		/* The walk may come across a frame twice if it was moved in
+		 * the frame table while frame_lock was dropped. */
+		if (c->page == page) {
+			lock_release (&ksm_lock);
+			return;
+		}
+		k = ksm_page_create (key.checksum);
+		if (k != NULL && !vm_frame_merge (&k->page, c->page)) {
+			free (k);
+			k = NULL;
+		}
+		if (k != NULL) {
+			/* The new merged page took over the frame of the earlier
+			 * candidate, which is left as its only user. */
+			k->ref_cnt = 1;
+			hash_insert (&merged_pages, &k->elem);
+			ksm_shared++;
+			hash_delete (candidates, &c->elem);
+			free (c);
+			if (vm_frame_merge (&k->page, page)) {
+				k->ref_cnt++;
+				ksm_saved++;
+			}
+		}
+	} else {
+		c = malloc (sizeof *c);
+		if (c != NULL) {
+			c->checksum = key.checksum;
+			c->page = page;
+			hash_insert (candidates, &c->elem);
+		}
+	}
+	lock_release (&ksm_lock);
+}
+
+static void
+candidate_free (struct hash_elem *e, void *aux UNUSED) {
+	free (hash_entry (e, struct ksm_candidate, elem));
+}
+
+/* Forgets the candidates of the current walk, whose pages may have
+ * been freed while vm_frame_walk() let go of frame_lock. */
+static void
+candidates_clear (void *candidates) {
+	hash_clear (candidates, candidate_free);
+}
+
+/* Merges pages, forever. */
+static void
+ksm_thread (void *aux UNUSED) {
+	struct hash candidates;
+
+	for (;;) {
+		timer_sleep (KSM_SCAN_TICKS);
+		if (!hash_init (&candidates, candidate_hash, candidate_less, NULL))
+			continue;
+		vm_frame_walk (ksm_scan_frame, candidates_clear, &candidates);
+		hash_destroy (&candidates, candidate_free);
+	}
+}
+
+static uint64_t
+ksm_page_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_entry (e, struct ksm_page, elem)->checksum;
+}
+
+static bool
+ksm_page_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct ksm_page, elem)->checksum
+		< hash_entry (b, struct ksm_page, elem)->checksum;
+}
+
+static uint64_t
+candidate_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_entry (e, struct ksm_candidate, elem)->checksum;
+}
+
+static bool
+candidate_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct ksm_candidate, elem)->checksum
+		< hash_entry (b, struct ksm_candidate, elem)->checksum;
+}
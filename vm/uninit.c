@@ -8,8 +8,10 @@
  * function.
  * */
 
+#include <string.h>
 #include "vm/vm.h"
 #include "vm/uninit.h"
+#include "threads/vaddr.h"
 
 static bool uninit_initialize (struct page *page, void *kva);
 static void uninit_destroy (struct page *page);
@@ -51,7 +53,10 @@ uninit_initialize (struct page *page, void *kva) {
 	vm_initializer *init = uninit->init;
 	void *aux = uninit->aux;
 
-	/* TODO: You may need to fix this function. */
+	/* A page without an initializer starts out zeroed; KVA may hold
+	 * an evicted page's data. */
+	if (init == NULL)
+		memset (kva, 0, PGSIZE);
 	return uninit->page_initializer (page, uninit->type, kva) &&
 		(init ? init (page, aux) : true);
 }
@@ -62,7 +67,9 @@ uninit_initialize (struct page *page, void *kva) {
  * PAGE will be freed by the caller. */
 static void
 uninit_destroy (struct page *page) {
-	struct uninit_page *uninit UNUSED = &page->uninit;
-	/* TODO: Fill this function.
-	 * TODO: If you don't have anything to do, just return. */
+	struct uninit_page *uninit = &page->uninit;
+
+	/* Initializers all take a struct file_load_info. */
+	file_load_info_free (uninit->aux);
+	vm_zero_unmap (page);
 }
@@ -1,8 +1,47 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <round.h>
+#include <string.h>
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "userprog/syscall.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
+#include "vm/ksm.h"
+
+/* The frame table: every frame that holds a user page, in the
+ * order the clock hand visits them.  Eviction, and any change to a
+ * page's FRAME member, happens with frame_lock held. */
+static struct list frame_table;
+static size_t frame_cnt;
+static unsigned frame_unlink_cnt;       /* Times a page lost its frame. */
+static struct list_elem *clock_hand;
+static struct lock frame_lock;
+static struct condition frame_loaded;   /* Signaled when a load ends. */
+
+/* A page of zeros, mapped read-only by pages that start out zeroed
+ * until they are first written, so that reading them takes no
+ * memory. */
+static void *zero_kva;
+
+/* Once the user pool runs dry, each eviction pass frees this many
+ * frames.  The victims' swap slots are allocated next-fit, so they
+ * are written out next to each other, and the spare frames serve
+ * the next few faults without another clock sweep. */
+#define VM_EVICT_CLUSTER 4
+
+/* vm_frame_walk() lets go of frame_lock after this many frames, so
+ * that faults and eviction do not wait for the whole walk. */
+#define VM_WALK_BATCH 32
+
+/* A fault on a page of an executable also reads in the other pages
+ * of the aligned block of this many pages around it that come from
+ * the next stretch of the same file, as long as free frames last.
+ * mmap() regions are left to load strictly on demand.  Set with the
+ * -fa kernel command-line option; 0 or 1 disables it. */
+size_t vm_fault_around = 16;
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
@@ -15,7 +54,13 @@ vm_init (void) {
 #endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
-	/* TODO: Your code goes here. */
+	list_init (&frame_table);
+	frame_cnt = 0;
+	clock_hand = NULL;
+	lock_init (&frame_lock);
+	cond_init (&frame_loaded);
+	zero_kva = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+	ksm_init ();
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -35,6 +80,7 @@ page_get_type (struct page *page) {
 /* Helpers */
 static struct frame *vm_get_victim (void);
 static bool vm_do_claim_page (struct page *page);
+static bool page_claim (struct page *page, bool evict);
 static struct frame *vm_evict_frame (void);
 
 /* Create the pending page object with initializer. If you want to create a
@@ -50,11 +96,32 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
+		bool (*initializer) (struct page *, enum vm_type, void *);
+		struct page *page;
+
+		switch (VM_TYPE (type)) {
+			case VM_ANON:
+				initializer = anon_initializer;
+				break;
+			case VM_FILE:
+				initializer = file_backed_initializer;
+				break;
+			default:
+				goto err;
+		}
 
-		/* TODO: Insert the page into the spt. */
+		page = malloc (sizeof *page);
+		if (page == NULL)
+			goto err;
+		uninit_new (page, upage, init, type, aux, initializer);
+		page->owner = thread_current ();
+		page->writable = writable;
+
+		if (!spt_insert_page (spt, page)) {
+			free (page);
+			goto err;
+		}
+		return true;
 	}
 err:
 	return false;
@@ -62,82 +129,891 @@ err:
 
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	struct page key;
+	struct hash_elem *e;
 
-	return page;
+	key.va = pg_round_down (va);
+	e = hash_find (&spt->pages, &key.spt_elem);
+	return e != NULL ? hash_entry (e, struct page, spt_elem) : NULL;
 }
 
 /* Insert PAGE into spt with validation. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
-
-	return succ;
+spt_insert_page (struct supplemental_page_table *spt, struct page *page) {
+	return hash_insert (&spt->pages, &page->spt_elem) == NULL;
 }
 
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	hash_delete (&spt->pages, &page->spt_elem);
 	vm_dealloc_page (page);
+}
+
+/* Adds REGION to spt as [START, END), of the given TYPE, with no
+ * file yet.  Returns false, without adding it, if it would overlap
+ * another region. */
+bool
+spt_add_region (struct supplemental_page_table *spt,
+		struct vm_region *region, enum vm_region_type type,
+		void *start, void *end) {
+	if (spt_find_region (spt, start, end) != NULL)
+		return false;
+	region->type = type;
+	region->file = NULL;
+	interval_insert (&spt->regions, &region->elem, (uintptr_t) start,
+			(uintptr_t) end);
 	return true;
 }
 
+/* Removes REGION from spt.  Its pages are left alone. */
+void
+spt_remove_region (struct supplemental_page_table *spt,
+		struct vm_region *region) {
+	interval_remove (&spt->regions, &region->elem);
+}
+
+/* Returns the region of spt that overlaps [START, END), or a null
+ * pointer if none does. */
+struct vm_region *
+spt_find_region (struct supplemental_page_table *spt, void *start,
+		void *end) {
+	struct interval_elem *e = interval_search (&spt->regions,
+			(uintptr_t) start, (uintptr_t) end);
+	return e != NULL ? interval_entry (e, struct vm_region, elem) : NULL;
+}
+
+/* Sets aside [START, END) of the current process's address space as
+ * a region of TYPE that is freed with the process.  If FILE is not
+ * null, the region gets a handle of its own on it, for its pages to
+ * share.  Returns the region, or a null pointer on failure. */
+struct vm_region *
+vm_reserve_region (enum vm_region_type type, void *start, void *end,
+		struct file *file) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct vm_region *region = malloc (sizeof *region);
+
+	if (region == NULL)
+		return NULL;
+	if (!spt_add_region (spt, region, type, start, end)) {
+		free (region);
+		return NULL;
+	}
+	if (file != NULL) {
+		region->file = file_reopen (file);
+		if (region->file == NULL) {
+			spt_remove_region (spt, region);
+			free (region);
+			return NULL;
+		}
+	}
+	return region;
+}
+
+/* Removes FRAME from the frame table, moving the clock hand past it
+ * if it points there.  Must be called with frame_lock held. */
+static void
+frame_table_remove (struct frame *frame) {
+	if (clock_hand == &frame->elem)
+		clock_hand = list_next (clock_hand);
+	list_remove (&frame->elem);
+	frame_cnt--;
+}
+
+/* Returns true if PAGE is an anonymous page merged with others. */
+static bool
+page_is_merged (struct page *page) {
+	return VM_TYPE (page->operations->type) == VM_ANON
+		&& page->anon.ksm != NULL;
+}
+
+/* Returns true if PAGE's frame should be mapped writable.  A merged
+ * page is mapped read-only even if the user may write to it. */
+static bool
+page_map_writable (struct page *page) {
+	return page->writable && !page_is_merged (page);
+}
+
+/* Waits until PAGE is not being brought in by another thread.  Must
+ * be called with frame_lock held. */
+static void
+frame_wait_loaded (struct page *page) {
+	while (page->frame != NULL && page->frame->loading) {
+		/* A fault inside read() holds the file system lock, which the
+		 * loading thread may be waiting for.  Take it again only after
+		 * frame_lock, to keep the lock order. */
+		bool fs_locked = lock_held_by_current_thread (&filesys_lock);
+
+		if (fs_locked)
+			lock_release (&filesys_lock);
+		cond_wait (&frame_loaded, &frame_lock);
+		if (fs_locked) {
+			lock_release (&frame_lock);
+			lock_acquire (&filesys_lock);
+			lock_acquire (&frame_lock);
+		}
+	}
+}
+
+/* Returns true if any page mapping FRAME was accessed since the
+ * last call, clearing their accessed bits. */
+static bool
+frame_accessed (struct frame *frame) {
+	struct list_elem *e;
+	bool accessed = false;
+
+	for (e = list_begin (&frame->maps); e != list_end (&frame->maps);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, map_elem);
+		uint64_t *pml4 = page->owner->pml4;
+
+		if (pml4_is_accessed (pml4, page->va)) {
+			pml4_set_accessed (pml4, page->va, false);
+			accessed = true;
+		}
+	}
+	return accessed;
+}
+
+/* Unmaps FRAME from every page that maps it.  The PTEs keep their
+ * dirty bits. */
+static void
+frame_unmap (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->maps); e != list_end (&frame->maps);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, map_elem);
+		pml4_clear_page (page->owner->pml4, page->va);
+	}
+}
+
+/* Maps FRAME again into every page that maps it, after
+ * frame_unmap(), restoring the dirty bits. */
+static void
+frame_remap (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->maps); e != list_end (&frame->maps);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, map_elem);
+		uint64_t *pml4 = page->owner->pml4;
+		bool dirty = pml4_is_dirty (pml4, page->va);
+
+		pml4_set_page (pml4, page->va, frame->kva, page_map_writable (page));
+		if (dirty)
+			pml4_set_dirty (pml4, page->va, true);
+	}
+}
+
+/* Drops the links between FRAME and the pages that map and own it. */
+static void
+frame_unlink (struct frame *frame) {
+	while (!list_empty (&frame->maps)) {
+		struct page *page = list_entry (list_pop_front (&frame->maps),
+				struct page, map_elem);
+		page->frame = NULL;
+	}
+	frame->page->frame = NULL;
+	frame->page = NULL;
+	frame_unlink_cnt++;
+}
+
 /* Get the struct frame, that will be evicted. */
 static struct frame *
 vm_get_victim (void) {
-	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+	size_t i;
+
+	/* Second chance: a frame whose page was accessed since the hand
+	 * last passed loses its accessed bit and is skipped.  Two full
+	 * turns are enough to find a victim unless all are pinned. */
+	for (i = 0; i < 2 * frame_cnt; i++) {
+		struct frame *frame;
+
+		if (clock_hand == NULL || clock_hand == list_end (&frame_table))
+			clock_hand = list_begin (&frame_table);
+		frame = list_entry (clock_hand, struct frame, elem);
+		clock_hand = list_next (clock_hand);
 
-	return victim;
+		if (frame->pinned)
+			continue;
+		if (frame_accessed (frame))
+			continue;
+		return frame;
+	}
+	return NULL;
+}
+
+/* Makes FRAME, which no page has used since the last call, the next
+ * frame the clock hand reaches, so that it is evicted before the
+ * others.  Must be called with frame_lock held. */
+static void
+frame_deactivate (struct frame *frame) {
+	struct list_elem *next = clock_hand != NULL ? clock_hand
+	                                            : list_end (&frame_table);
+
+	frame_accessed (frame);
+	if (next == &frame->elem)
+		return;
+	list_remove (&frame->elem);
+	if (next == list_end (&frame_table))
+		next = list_begin (&frame_table);
+	list_insert (next, &frame->elem);
+	clock_hand = &frame->elem;
+}
+
+/* Writes out the page in FRAME and unmaps it from its owner.
+ * Returns false, leaving the page in place, if its swap_out
+ * operation cannot run now. */
+static bool
+frame_evict (struct frame *frame) {
+	/* Unmap first, so that no process can change the page while it
+	 * is being written out. */
+	frame->pinned++;
+	frame_unmap (frame);
+	if (!swap_out (frame->page)) {
+		frame_remap (frame);
+		frame->pinned--;
+		return false;
+	}
+
+	frame_unlink (frame);
+	frame->pinned--;
+	return true;
 }
 
 /* Evict one page and return the corresponding frame.
  * Return NULL on error.*/
 static struct frame *
 vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+	struct frame *victim;
+	size_t tries;
 
+	for (tries = 0; tries <= frame_cnt; tries++) {
+		victim = vm_get_victim ();
+		if (victim == NULL)
+			break;
+		if (frame_evict (victim))
+			return victim;
+	}
 	return NULL;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
  * and return it. This always return valid address. That is, if the user pool
  * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * space.
+ * Must be called with frame_lock held.  The frame is returned pinned.
+ * If EVICT is false, returns a null pointer instead of evicting. */
 static struct frame *
-vm_get_frame (void) {
+vm_get_frame (bool evict) {
 	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
+	void *kva = palloc_get_page (PAL_USER);
+
+	if (kva != NULL) {
+		frame = malloc (sizeof *frame);
+		if (frame == NULL)
+			palloc_free_page (kva);
+		else {
+			frame->kva = kva;
+			frame->page = NULL;
+			list_init (&frame->maps);
+			list_insert (clock_hand != NULL ? clock_hand
+			                                : list_end (&frame_table),
+					&frame->elem);
+			frame_cnt++;
+		}
+	} else if (!evict)
+		return NULL;
+	else {
+		size_t i;
+
+		frame = vm_evict_frame ();
+		for (i = 1; frame != NULL && i < VM_EVICT_CLUSTER; i++) {
+			struct frame *spare = vm_evict_frame ();
+			if (spare == NULL)
+				break;
+			frame_table_remove (spare);
+			palloc_free_page (spare->kva);
+			free (spare);
+		}
+	}
 
 	ASSERT (frame != NULL);
 	ASSERT (frame->page == NULL);
+	frame->pinned = 1;
+	frame->loading = false;
 	return frame;
 }
 
+/* Unmaps the frame owned by PAGE and takes it out of the frame
+ * table.  Returns the frame's kernel virtual address, which the
+ * caller must free with palloc_free_page(), or a null pointer if
+ * PAGE was not resident.  The PTE keeps its dirty bit for the caller
+ * to read. */
+void *
+vm_frame_detach (struct page *page) {
+	struct frame *frame;
+	void *kva = NULL;
+
+	lock_acquire (&frame_lock);
+	frame = page->frame;
+	if (frame != NULL) {
+		ASSERT (frame->page == page);
+		frame_unmap (frame);
+		frame_unlink (frame);
+		frame_table_remove (frame);
+		kva = frame->kva;
+		free (frame);
+	}
+	lock_release (&frame_lock);
+	return kva;
+}
+
+/* Maps the frame of OWNER, a page that no process maps itself, at
+ * PAGE's address, bringing OWNER in first if needed.  Evicts another
+ * page for it only if EVICT is true. */
+bool
+vm_frame_share (struct page *page, struct page *owner, bool evict) {
+	ASSERT (owner->owner == NULL);
+
+	for (;;) {
+		struct frame *frame;
+		bool ok = true;
+
+		lock_acquire (&frame_lock);
+		frame_wait_loaded (owner);
+		frame = owner->frame;
+		if (page->frame == NULL && frame != NULL) {
+			ok = pml4_set_page (page->owner->pml4, page->va, frame->kva,
+					page_map_writable (page));
+			if (ok) {
+				page->frame = frame;
+				list_push_back (&frame->maps, &page->map_elem);
+			}
+		}
+		if (page->frame != NULL || !ok) {
+			lock_release (&frame_lock);
+			return ok;
+		}
+		lock_release (&frame_lock);
+
+		if (!page_claim (owner, evict))
+			return false;
+	}
+}
+
+/* Unmaps PAGE from the frame that vm_frame_share() mapped there.
+ * The PTE keeps its dirty bit. */
+void
+vm_frame_unshare (struct page *page) {
+	lock_acquire (&frame_lock);
+	if (page->frame != NULL) {
+		ASSERT (page->frame->page != page);
+		pml4_clear_page (page->owner->pml4, page->va);
+		list_remove (&page->map_elem);
+		page->frame = NULL;
+	}
+	lock_release (&frame_lock);
+}
+
+/* Pins the frame of PAGE in place, if PAGE is resident.  Returns
+ * true if it was. */
+bool
+vm_frame_pin (struct page *page) {
+	bool resident;
+
+	lock_acquire (&frame_lock);
+	frame_wait_loaded (page);
+	resident = page->frame != NULL;
+	if (resident)
+		page->frame->pinned++;
+	lock_release (&frame_lock);
+	return resident;
+}
+
+/* Lets PAGE's frame be evicted again. */
+void
+vm_frame_unpin (struct page *page) {
+	lock_acquire (&frame_lock);
+	ASSERT (page->frame->pinned > 0);
+	page->frame->pinned--;
+	lock_release (&frame_lock);
+}
+
+/* Returns true if a page mapping the frame of resident PAGE wrote
+ * to it, clearing their dirty bits if CLEAR is true.  Eviction calls
+ * this with frame_lock held. */
+bool
+vm_frame_dirty (struct page *page, bool clear) {
+	bool locked = !lock_held_by_current_thread (&frame_lock);
+	struct list_elem *e;
+	bool dirty = false;
+
+	if (locked)
+		lock_acquire (&frame_lock);
+	for (e = list_begin (&page->frame->maps); e != list_end (&page->frame->maps);
+			e = list_next (e)) {
+		struct page *map = list_entry (e, struct page, map_elem);
+		uint64_t *pml4 = map->owner->pml4;
+
+		if (pml4_is_dirty (pml4, map->va)) {
+			dirty = true;
+			if (clear)
+				pml4_set_dirty (pml4, map->va, false);
+		}
+	}
+	if (locked)
+		lock_release (&frame_lock);
+	return dirty;
+}
+
+/* Calls FN with AUX on each frame in the frame table, with
+ * frame_lock held.  FN may free the frame it is given, but no
+ * other.  The lock is dropped after every VM_WALK_BATCH frames; a
+ * marker that looks like a pinned frame with no page keeps the place
+ * meanwhile.  If a page lost its frame while the lock was dropped,
+ * RESTART is called with AUX, since a page seen earlier in the walk
+ * may then be gone. */
+void
+vm_frame_walk (void (*fn) (struct frame *, void *),
+		void (*restart) (void *), void *aux) {
+	struct frame marker = { .page = NULL, .pinned = 1 };
+	struct list_elem *e, *next;
+	unsigned unlink_cnt;
+	size_t cnt = 0;
+
+	lock_acquire (&frame_lock);
+	unlink_cnt = frame_unlink_cnt;
+	for (e = list_begin (&frame_table); e != list_end (&frame_table); e = next) {
+		next = list_next (e);
+		fn (list_entry (e, struct frame, elem), aux);
+		if (++cnt % VM_WALK_BATCH != 0 || next == list_end (&frame_table))
+			continue;
+
+		list_insert (next, &marker.elem);
+		lock_release (&frame_lock);
+		thread_yield ();
+		lock_acquire (&frame_lock);
+		next = list_next (&marker.elem);
+		if (clock_hand == &marker.elem)
+			clock_hand = next;
+		list_remove (&marker.elem);
+		if (frame_unlink_cnt != unlink_cnt) {
+			unlink_cnt = frame_unlink_cnt;
+			restart (aux);
+		}
+	}
+	lock_release (&frame_lock);
+}
+
+/* Merges PAGE, a resident anonymous page with a frame of its own,
+ * into KSM, an anonymous page that no process maps itself: PAGE's
+ * frame is freed and PAGE maps KSM's frame read-only instead.  Does
+ * nothing and returns false if the two frames differ, or if KSM's
+ * frame is loading or pinned.  If KSM has no
+ * frame yet, it takes over PAGE's, which PAGE keeps mapping
+ * read-only.  Must be called with frame_lock held. */
+bool
+vm_frame_merge (struct page *ksm, struct page *page) {
+	struct frame *frame = page->frame, *shared = ksm->frame;
+	uint64_t *pml4 = page->owner->pml4;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+	ASSERT (ksm->owner == NULL);
+	ASSERT (frame != NULL && frame->page == page);
+
+	/* KSM's frame may still be being read back in, or be in use by
+	 * another thread. */
+	if (shared != NULL && (shared->loading || shared->pinned))
+		return false;
+
+	/* Write-protect PAGE first, so that it cannot change while it is
+	 * compared.  With CR0.WP set, this holds for the kernel's stores
+	 * too, which fault into vm_handle_wp() like the user's. */
+	page->anon.ksm = ksm;
+	pml4_set_page (pml4, page->va, frame->kva, false);
+	if (shared == NULL) {
+		frame->page = ksm;
+		ksm->frame = frame;
+		return true;
+	}
+	if (memcmp (frame->kva, shared->kva, PGSIZE)) {
+		page->anon.ksm = NULL;
+		pml4_set_page (pml4, page->va, frame->kva, page->writable);
+		return false;
+	}
+
+	pml4_set_page (pml4, page->va, shared->kva, false);
+	list_remove (&page->map_elem);
+	list_push_back (&shared->maps, &page->map_elem);
+	page->frame = shared;
+	frame_table_remove (frame);
+	palloc_free_page (frame->kva);
+	free (frame);
+	return true;
+}
+
+/* Gives PAGE, which was merged with other pages, a copy of its own
+ * of the merged frame that it maps. */
+static bool
+vm_unmerge (struct page *page) {
+	struct frame *frame, *shared;
+	struct page *ksm;
+
+	lock_acquire (&frame_lock);
+	ksm = page->anon.ksm;
+	shared = page->frame;
+	if (ksm == NULL || shared == NULL) {
+		/* Unmerged or evicted meanwhile: just retry the access. */
+		lock_release (&frame_lock);
+		return true;
+	}
+
+	shared->pinned++;
+	frame = vm_get_frame (true);
+	memcpy (frame->kva, shared->kva, PGSIZE);
+	pml4_clear_page (page->owner->pml4, page->va);
+	list_remove (&page->map_elem);
+	shared->pinned--;
+
+	frame->page = page;
+	page->frame = frame;
+	page->anon.ksm = NULL;
+	list_push_back (&frame->maps, &page->map_elem);
+	pml4_set_page (page->owner->pml4, page->va, frame->kva, page->writable);
+	frame->pinned--;
+	lock_release (&frame_lock);
+
+	ksm_put (ksm);
+	return true;
+}
+
+/* Makes PAGE resident and pins its frame in place.  Returns false
+ * if PAGE cannot be brought in. */
+static bool
+page_pin (struct page *page) {
+	for (;;) {
+		if (vm_frame_pin (page))
+			return true;
+		if (!vm_do_claim_page (page))
+			return false;
+	}
+}
+
+/* Lets PAGE's frame be evicted again. */
+static void
+page_unpin (struct page *page) {
+	vm_frame_unpin (page);
+}
+
+/* Returns true if a fault at ADDR, with the user stack pointer at
+ * RSP, should grow the stack.  PUSH may fault 8 bytes below RSP. */
+bool
+vm_is_stack_access (void *addr, void *rsp) {
+	return (uint8_t *) addr >= (uint8_t *) rsp - 8
+		&& (uint8_t *) addr < (uint8_t *) USER_STACK
+		&& (uint8_t *) addr >= (uint8_t *) USER_STACK - VM_STACK_LIMIT;
+}
+
 /* Growing the stack. */
 static void
-vm_stack_growth (void *addr UNUSED) {
+vm_stack_growth (void *addr) {
+	vm_alloc_page (VM_ANON | VM_STACK, pg_round_down (addr), true);
+}
+
+/* Returns true if PAGE is not resident and claiming it would read
+ * its contents from an executable, storing the file's inode in
+ * *INODE and the contents' offset in *OFS. */
+static bool
+page_file_pos (struct page *page, struct inode **inode, off_t *ofs) {
+	if (page->frame != NULL)
+		return false;
+
+	switch (VM_TYPE (page->operations->type)) {
+		case VM_UNINIT: {
+			struct file_load_info *info = page->uninit.aux;
+			if (info == NULL || info->region->type != VM_REGION_SEGMENT
+					|| info->read_bytes == 0)
+				return false;
+			*inode = file_get_inode (info->file);
+			*ofs = info->ofs;
+			return true;
+		}
+		case VM_FILE:
+			if (page->file.region->type != VM_REGION_SEGMENT)
+				return false;
+			*inode = file_get_inode (page->file.file);
+			*ofs = page->file.ofs;
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* Reads in the pages around FAULT_VA, which was just read from
+ * INODE at OFS, whose data follows on in the same file.  Stops when
+ * the user pool runs out rather than evicting anything. */
+static void
+vm_fault_around_pages (struct supplemental_page_table *spt, void *fault_va,
+		struct inode *inode, off_t ofs) {
+	uint8_t *start;
+	size_t i;
+
+	if (vm_fault_around <= 1)
+		return;
+	start = (uint8_t *) fault_va - pg_no (fault_va) % vm_fault_around * PGSIZE;
+	for (i = 0; i < vm_fault_around; i++) {
+		uint8_t *va = start + i * PGSIZE;
+		struct inode *page_inode;
+		off_t page_ofs;
+		struct page *page;
+
+		if (va == fault_va || !is_user_vaddr (va))
+			continue;
+		page = spt_find_page (spt, va);
+		if (page == NULL || !page_file_pos (page, &page_inode, &page_ofs)
+				|| page_inode != inode
+				|| page_ofs - ofs != va - (uint8_t *) fault_va)
+			continue;
+		if (!page_claim (page, false))
+			break;
+	}
+}
+
+/* Returns true if PAGE has not been brought in yet and would start
+ * out as all zeros. */
+static bool
+page_is_zero (struct page *page) {
+	return VM_TYPE (page->operations->type) == VM_UNINIT
+		&& VM_TYPE (page->uninit.type) == VM_ANON
+		&& page->uninit.init == NULL && page->uninit.aux == NULL;
+}
+
+/* Brings PAGE in ahead of use, if it is not resident and has data
+ * to bring in, without evicting anything.  Returns false once the
+ * user pool runs out. */
+static bool
+page_prefetch (struct page *page) {
+	if (page->frame != NULL || page_is_zero (page))
+		return true;
+	return page_claim (page, false);
+}
+
+/* Sequential access: after a fault at FAULT_VA, reads in the next
+ * pages that were advised sequential, and makes the ones well
+ * behind it the next to be evicted, since they will not be used
+ * again soon.  Each fault handles a window of vm_fault_around pages,
+ * at least 8. */
+static void
+vm_sequential_pages (struct supplemental_page_table *spt, void *fault_va) {
+	size_t window = vm_fault_around > 8 ? vm_fault_around : 8;
+	size_t i;
+
+	for (i = 1; i <= window; i++) {
+		struct page *page = spt_find_page (spt,
+				(uint8_t *) fault_va + i * PGSIZE);
+		if (page == NULL || page->advice != VM_ADVICE_SEQUENTIAL
+				|| !page_prefetch (page))
+			break;
+	}
+
+	lock_acquire (&frame_lock);
+	for (i = window + 1; i <= 2 * window; i++) {
+		uint8_t *va = (uint8_t *) fault_va - i * PGSIZE;
+		struct page *page;
+
+		if (va > (uint8_t *) fault_va)
+			break;
+		page = spt_find_page (spt, va);
+		if (page != NULL && page->advice == VM_ADVICE_SEQUENTIAL
+				&& page->frame != NULL && !page->frame->loading)
+			frame_deactivate (page->frame);
+	}
+	lock_release (&frame_lock);
 }
 
-/* Handle the fault on write_protected page */
+/* Maps the zero frame read-only at PAGE's address. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+vm_zero_map (struct page *page) {
+	if (!pml4_set_page (page->owner->pml4, page->va, zero_kva, false))
+		return false;
+	page->zero = true;
+	return true;
+}
+
+/* Unmaps the zero frame from PAGE, if it is mapped there. */
+void
+vm_zero_unmap (struct page *page) {
+	if (page->zero) {
+		pml4_clear_page (page->owner->pml4, page->va);
+		page->zero = false;
+	}
+}
+
+/* Handle the fault on write_protected page.  CR0.WP is set, so this
+ * also catches the kernel storing into a user buffer, as read()
+ * does, which must not reach a shared frame either. */
+static bool
+vm_handle_wp (struct page *page) {
+	/* The first write to a page that reads as zeros, or that was
+	 * merged with others, gives it a frame of its own. */
+	if (page->zero) {
+		vm_zero_unmap (page);
+		return vm_do_claim_page (page);
+	}
+	if (page_is_merged (page))
+		return vm_unmerge (page);
+	return false;
 }
 
 /* Return true on success */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
 	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
 
-	return vm_do_claim_page (page);
+	if (addr == NULL || is_kernel_vaddr (addr))
+		return false;
+
+	page = spt_find_page (spt, addr);
+	if (!not_present)
+		return page != NULL && write && page->writable && vm_handle_wp (page);
+
+	if (page == NULL) {
+		/* A kernel fault on a user address comes from a system call,
+		 * which saved the user's stack pointer on entry. */
+		void *rsp = user ? (void *) f->rsp : thread_current ()->user_rsp;
+		struct vm_region *region = spt_find_region (spt, addr,
+				(uint8_t *) addr + 1);
+		if (region == NULL || region->type != VM_REGION_STACK
+				|| !vm_is_stack_access (addr, rsp))
+			return false;
+		vm_stack_growth (addr);
+		page = spt_find_page (spt, addr);
+		if (page == NULL)
+			return false;
+	}
+	if (write && !page->writable)
+		return false;
+	if (!write && page_is_zero (page))
+		return vm_zero_map (page);
+
+	struct inode *inode;
+	off_t ofs;
+	bool around = page->advice == VM_ADVICE_NORMAL
+		&& page_file_pos (page, &inode, &ofs);
+
+	if (!vm_do_claim_page (page))
+		return false;
+	if (page->advice == VM_ADVICE_SEQUENTIAL)
+		vm_sequential_pages (spt, page->va);
+	else if (around)
+		vm_fault_around_pages (spt, page->va, inode, ofs);
+	return true;
+}
+
+/* Writes PAGE out and frees its frame, if it has one of its own that
+ * nobody has pinned. */
+static void
+page_evict (struct page *page) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	frame_wait_loaded (page);
+	frame = page->frame;
+	if (frame != NULL && frame->page == page && !frame->pinned
+			&& frame_evict (frame)) {
+		frame_table_remove (frame);
+		palloc_free_page (frame->kva);
+		free (frame);
+	}
+	lock_release (&frame_lock);
+}
+
+/* Frees the memory that PAGE, in a region of TYPE, takes up.  The
+ * stack is private anonymous memory, which reads back as zeros, as
+ * elsewhere.  Other anonymous pages hold data of the executable and
+ * are written out instead.  A file page drops the page cache's frame
+ * and maps it again on the next access. */
+static void
+page_dontneed (struct supplemental_page_table *spt, struct page *page,
+		enum vm_region_type type) {
+	void *va = page->va;
+	bool writable = page->writable;
+	enum vm_advice advice = page->advice;
+	struct file_load_info *info;
+	bool ok;
+
+	switch (VM_TYPE (page->operations->type)) {
+		case VM_ANON:
+			if (type != VM_REGION_STACK) {
+				page_evict (page);
+				return;
+			}
+			spt_remove_page (spt, page);
+			ok = vm_alloc_page (VM_ANON | VM_STACK, va, writable);
+			break;
+		case VM_FILE:
+			info = file_page_load_info (spt, page);
+			if (info == NULL)
+				return;
+			spt_remove_page (spt, page);
+			ok = vm_alloc_page_with_initializer (VM_FILE, va, writable,
+					file_lazy_load, info);
+			if (!ok)
+				file_load_info_free (info);
+			break;
+		default:
+			return;
+	}
+	if (ok)
+		spt_find_page (spt, va)->advice = advice;
+}
+
+/* Applies ADVICE to the current process's pages in [ADDR, ADDR +
+ * LENGTH), which must be page-aligned.  Only pages of the process's
+ * regions are visited, so a large range with little in it is cheap.
+ * Returns false if the range is invalid. */
+bool
+vm_madvise (void *addr, size_t length, enum vm_advice advice) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *start = addr, *end = start + ROUND_UP (length, PGSIZE);
+	struct interval_elem *e;
+	bool prefetch = true;
+
+	if (pg_ofs (addr) != 0 || length == 0 || advice > VM_ADVICE_DONTNEED
+			|| end <= start || !is_user_vaddr (end - 1))
+		return false;
+
+	e = interval_search (&spt->regions, (uintptr_t) start, (uintptr_t) end);
+	for (; e != NULL && e->start < (uintptr_t) end;
+			e = interval_next (&spt->regions, e)) {
+		struct vm_region *region = interval_entry (e, struct vm_region, elem);
+		uint8_t *va = (uint8_t *) (e->start > (uintptr_t) start
+				? e->start : (uintptr_t) start);
+		uint8_t *va_end = (uint8_t *) (e->end < (uintptr_t) end
+				? e->end : (uintptr_t) end);
+
+		for (; va < va_end; va += PGSIZE) {
+			struct page *page = spt_find_page (spt, va);
+			if (page == NULL)
+				continue;
+			switch (advice) {
+				case VM_ADVICE_WILLNEED:
+					prefetch = prefetch && page_prefetch (page);
+					break;
+				case VM_ADVICE_DONTNEED:
+					page_dontneed (spt, page, region->type);
+					break;
+				default:
+					page->advice = advice;
+					break;
+			}
+		}
+	}
+	return true;
 }
 
 /* Free the page.
@@ -150,41 +1026,204 @@ vm_dealloc_page (struct page *page) {
 
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct page *page = spt_find_page (&thread_current ()->spt, va);
 
+	if (page == NULL)
+		return false;
 	return vm_do_claim_page (page);
 }
 
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+	return page_claim (page, true);
+}
+
+/* Claims PAGE, evicting another page for it if EVICT is true and
+ * the user pool is empty. */
+static bool
+page_claim (struct page *page, bool evict) {
+	struct frame *frame;
+
+	/* File data is shared through the page cache. */
+	if (page->owner != NULL && page_get_type (page) == VM_FILE)
+		return file_backed_claim (page, evict);
+	if (page->owner != NULL && page_is_merged (page))
+		return vm_frame_share (page, page->anon.ksm, evict);
+	vm_zero_unmap (page);
+
+	lock_acquire (&frame_lock);
+	frame_wait_loaded (page);
+	if (page->frame != NULL) {
+		/* Brought in while we waited for the lock. */
+		lock_release (&frame_lock);
+		return true;
+	}
+	frame = vm_get_frame (evict);
+	if (frame == NULL) {
+		lock_release (&frame_lock);
+		return false;
+	}
 
 	/* Set links */
 	frame->page = page;
+	frame->loading = true;
 	page->frame = frame;
+	if (page->owner != NULL)
+		list_push_back (&frame->maps, &page->map_elem);
+	lock_release (&frame_lock);
+
+	/* Fill the frame before mapping it, so that the owner never sees
+	 * it half loaded.  It stays pinned until then.  Pages of the page
+	 * cache have no owner and are mapped by vm_frame_share(). */
+	if (!swap_in (page, frame->kva)
+			|| (page->owner != NULL
+				&& !pml4_set_page (page->owner->pml4, page->va, frame->kva,
+					page->writable))) {
+		lock_acquire (&frame_lock);
+		if (page->owner != NULL)
+			list_remove (&page->map_elem);
+		frame_table_remove (frame);
+		page->frame = NULL;
+		cond_broadcast (&frame_loaded, &frame_lock);
+		lock_release (&frame_lock);
+		palloc_free_page (frame->kva);
+		free (frame);
+		return false;
+	}
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+	lock_acquire (&frame_lock);
+	frame->loading = false;
+	frame->pinned--;
+	cond_broadcast (&frame_loaded, &frame_lock);
+	lock_release (&frame_lock);
+	return true;
+}
 
-	return swap_in (page, frame->kva);
+static uint64_t
+page_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct page *page = hash_entry (e, struct page, spt_elem);
+	return hash_bytes (&page->va, sizeof page->va);
+}
+
+static bool
+page_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct page, spt_elem)->va
+		< hash_entry (b, struct page, spt_elem)->va;
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	hash_init (&spt->pages, page_hash, page_less, NULL);
+	interval_init (&spt->regions);
+	ksm_start ();
+}
+
+/* Copies page SRC, owned by another process, to the same address in
+ * the current process's table DST. */
+static bool
+page_copy (struct supplemental_page_table *dst, struct page *src) {
+	enum vm_type type = page_get_type (src);
+	struct page *page;
+	void *aux = NULL;
+	bool ok;
+
+	/* A page that was never touched is copied as the same promise. */
+	if (VM_TYPE (src->operations->type) == VM_UNINIT) {
+		if (src->uninit.aux != NULL) {
+			aux = file_load_info_copy (dst, src->uninit.aux);
+			if (aux == NULL)
+				return false;
+		}
+		if (!vm_alloc_page_with_initializer (src->uninit.type, src->va,
+					src->writable, src->uninit.init, aux)) {
+			file_load_info_free (aux);
+			return false;
+		}
+		return true;
+	}
+
+	/* mmap()ed data lives in the page cache, which the copy shares. */
+	if (type == VM_FILE) {
+		aux = file_page_load_info (dst, src);
+		if (aux == NULL)
+			return false;
+		if (!vm_alloc_page_with_initializer (src->operations->type, src->va,
+					src->writable, file_lazy_load, aux)) {
+			file_load_info_free (aux);
+			return false;
+		}
+		return true;
+	}
+
+	/* Otherwise copy the contents. */
+	if (!vm_alloc_page_with_initializer (src->operations->type, src->va,
+				src->writable, NULL, NULL))
+		return false;
+	page = spt_find_page (dst, src->va);
+
+	if (!page_pin (src))
+		return false;
+	ok = page_pin (page);
+	if (ok) {
+		memcpy (page->frame->kva, src->frame->kva, PGSIZE);
+		page_unpin (page);
+	}
+	page_unpin (src);
+	return ok;
 }
 
 /* Copy supplemental page table from src to dst */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct hash_iterator i;
+	struct interval_elem *e;
+
+	/* Copy the regions first: copies of mmap()ed pages refer to them. */
+	for (e = interval_first (&src->regions); e != NULL;
+			e = interval_next (&src->regions, e)) {
+		struct vm_region *region = interval_entry (e, struct vm_region, elem);
+		bool ok = region->type == VM_REGION_MMAP
+			? file_mmap_copy (dst, (struct mmap_region *) region)
+			: vm_reserve_region (region->type, (void *) e->start,
+					(void *) e->end, region->file) != NULL;
+		if (!ok)
+			return false;
+	}
+
+	hash_first (&i, &src->pages);
+	while (hash_next (&i)) {
+		struct page *page = hash_entry (hash_cur (&i), struct page, spt_elem);
+		if (!page_copy (dst, page))
+			return false;
+		spt_find_page (dst, page->va)->advice = page->advice;
+	}
+	return true;
+}
+
+static void
+page_destroy (struct hash_elem *e, void *aux UNUSED) {
+	vm_dealloc_page (hash_entry (e, struct page, spt_elem));
 }
 
 /* Free the resource hold by the supplemental page table */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	/* Unmapping writes mmap()ed pages back to their files. */
+	while (!interval_empty (&spt->regions)) {
+		struct vm_region *region = interval_entry (
+				interval_first (&spt->regions), struct vm_region, elem);
+		if (region->type == VM_REGION_MMAP)
+			file_mmap_remove (spt, (struct mmap_region *) region);
+		else {
+			spt_remove_region (spt, region);
+			file_close (region->file);
+			free (region);
+		}
+	}
+	hash_clear (&spt->pages, page_destroy);
 }
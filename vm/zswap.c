@@ -0,0 +1,313 @@
+/* zswap.c: Compressed in-memory cache in front of the swap disk.
+ *
+ * Anonymous pages chosen for eviction are first compressed with a
+ * small LZ77 coder (in the spirit of LZ4) and kept in a fixed arena
+ * of kernel pages.  Swapping such a page back in costs a
+ * decompression instead of a disk read.  Pages that do not shrink
+ * enough, or that do not fit because the arena is full, go to the
+ * swap disk as before.
+ *
+ * The arena is carved into ZSWAP_GRANULE-byte granules tracked by a
+ * bitmap; a compressed page occupies a run of adjacent granules. */
+
+#include "vm/zswap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Size of the arena, in pages. */
+#define ZSWAP_PAGES 64
+
+/* Arena allocation unit, in bytes. */
+#define ZSWAP_GRANULE 64
+#define GRANULES_PER_PAGE (PGSIZE / ZSWAP_GRANULE)
+
+/* Pages that do not compress to this many bytes or fewer are not
+ * worth keeping in memory. */
+#define ZSWAP_MAX_LEN (PGSIZE * 3 / 4)
+
+static uint8_t *arena;                  /* ZSWAP_PAGES pages. */
+static struct bitmap *granules;         /* Bit per granule, set if used. */
+static struct lock zswap_lock;
+
+/* Compressor state, protected by zswap_lock.  Both are too big for
+ * a kernel stack. */
+#define HASH_BITS 12
+static uint16_t hash_table[1 << HASH_BITS];
+static uint8_t scratch[ZSWAP_MAX_LEN];
+
+/* Statistics. */
+static long long stored_cnt;            /* Pages stored in the arena. */
+static long long loaded_cnt;            /* Pages loaded back. */
+static long long reject_cnt;            /* Pages that compressed poorly. */
+static long long full_cnt;              /* Pages that did not fit. */
+
+static size_t lz_compress (const uint8_t *, size_t, uint8_t *, size_t);
+static bool lz_decompress (const uint8_t *, size_t, uint8_t *, size_t);
+
+/* Sets up the arena.  If the kernel pool cannot spare it, every
+ * page goes straight to the swap disk. */
+void
+zswap_init (void) {
+	lock_init (&zswap_lock);
+	arena = palloc_get_multiple (0, ZSWAP_PAGES);
+	if (arena == NULL)
+		return;
+	granules = bitmap_create (ZSWAP_PAGES * GRANULES_PER_PAGE);
+	if (granules == NULL) {
+		palloc_free_multiple (arena, ZSWAP_PAGES);
+		arena = NULL;
+	}
+}
+
+/* Compresses the page at KVA into the arena.  On success, stores the
+ * first granule in *IDX and the compressed length in *LEN and returns
+ * true.  Returns false if the page should go to the swap disk. */
+bool
+zswap_store (const void *kva, size_t *idx, size_t *len) {
+	size_t n, first;
+
+	if (arena == NULL)
+		return false;
+
+	lock_acquire (&zswap_lock);
+	n = lz_compress (kva, PGSIZE, scratch, sizeof scratch);
+	if (n == 0) {
+		reject_cnt++;
+		lock_release (&zswap_lock);
+		return false;
+	}
+	first = bitmap_scan_and_flip (granules, 0,
+			DIV_ROUND_UP (n, ZSWAP_GRANULE), false);
+	if (first == BITMAP_ERROR) {
+		full_cnt++;
+		lock_release (&zswap_lock);
+		return false;
+	}
+	memcpy (arena + first * ZSWAP_GRANULE, scratch, n);
+	stored_cnt++;
+	lock_release (&zswap_lock);
+
+	*idx = first;
+	*len = n;
+	return true;
+}
+
+/* Decompresses the LEN-byte page stored at granule IDX into KVA and
+ * releases its granules. */
+void
+zswap_load (size_t idx, size_t len, void *kva) {
+	bool ok;
+
+	ok = lz_decompress (arena + idx * ZSWAP_GRANULE, len, kva, PGSIZE);
+	ASSERT (ok);
+	zswap_free (idx, len);
+
+	lock_acquire (&zswap_lock);
+	loaded_cnt++;
+	lock_release (&zswap_lock);
+}
+
+/* Releases the LEN-byte page stored at granule IDX. */
+void
+zswap_free (size_t idx, size_t len) {
+	lock_acquire (&zswap_lock);
+	bitmap_set_multiple (granules, idx, DIV_ROUND_UP (len, ZSWAP_GRANULE),
+			false);
+	lock_release (&zswap_lock);
+}
+
+/* Prints compressed swap statistics. */
+void
+zswap_print_stats (void) {
+	if (arena == NULL)
+		return;
+	printf ("Zswap: %lld pages stored, %lld loaded, %lld incompressible, "
+			"%lld overflowed to disk\n",
+			stored_cnt, loaded_cnt, reject_cnt, full_cnt);
+}
+
+/* The compressed format is a series of sequences, each a token byte
+ * followed by literal bytes, a 2-byte little-endian match offset, and
+ * a match length.  The token's high nibble is the literal count and
+ * its low nibble the match length minus MIN_MATCH; a nibble of 15
+ * means extra length bytes follow, each adding its value, until one
+ * is less than 255.  The final sequence has literals only. */
+#define MIN_MATCH 4
+
+static uint32_t
+read32 (const uint8_t *p) {
+	uint32_t v;
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+static unsigned
+hash4 (const uint8_t *p) {
+	return (read32 (p) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Returns the encoded size of a sequence with LIT literals and a
+ * match of MLEN (less MIN_MATCH) bytes, or no match if !HAS_MATCH. */
+static size_t
+sequence_size (size_t lit, size_t mlen, bool has_match) {
+	size_t size = 1 + lit;
+
+	if (lit >= 15)
+		size += (lit - 15) / 255 + 1;
+	if (has_match) {
+		size += 2;
+		if (mlen >= 15)
+			size += (mlen - 15) / 255 + 1;
+	}
+	return size;
+}
+
+/* Appends the extra length bytes for LEN to OP. */
+static uint8_t *
+put_len (uint8_t *op, size_t len) {
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+/* Appends a sequence of LIT literals at ANCHOR to OP, followed by a
+ * match at OFFSET bytes back of MLEN + MIN_MATCH bytes if OFFSET is
+ * nonzero. */
+static uint8_t *
+put_sequence (uint8_t *op, const uint8_t *anchor, size_t lit,
+		size_t offset, size_t mlen) {
+	uint8_t *token = op++;
+
+	*token = (lit >= 15 ? 15 : lit) << 4;
+	if (lit >= 15)
+		op = put_len (op, lit - 15);
+	memcpy (op, anchor, lit);
+	op += lit;
+
+	if (offset != 0) {
+		*token |= mlen >= 15 ? 15 : mlen;
+		*op++ = offset & 0xff;
+		*op++ = offset >> 8;
+		if (mlen >= 15)
+			op = put_len (op, mlen - 15);
+	}
+	return op;
+}
+
+/* Compresses SRC_LEN bytes at SRC into DST.  Returns the compressed
+ * size, or 0 if it would exceed DST_MAX bytes. */
+static size_t
+lz_compress (const uint8_t *src, size_t src_len, uint8_t *dst,
+		size_t dst_max) {
+	const uint8_t *ip = src, *anchor = src, *end = src + src_len;
+	uint8_t *op = dst;
+	size_t lit;
+
+	memset (hash_table, 0, sizeof hash_table);
+	while (end - ip >= MIN_MATCH) {
+		unsigned h = hash4 (ip);
+		const uint8_t *ref = src + hash_table[h];
+		const uint8_t *mp, *rp;
+		size_t mlen;
+
+		hash_table[h] = ip - src;
+		if (ref >= ip || ip - ref > 0xffff || read32 (ref) != read32 (ip)) {
+			ip++;
+			continue;
+		}
+
+		for (mp = ip + MIN_MATCH, rp = ref + MIN_MATCH; mp < end && *mp == *rp;
+				mp++, rp++)
+			continue;
+		lit = ip - anchor;
+		mlen = mp - ip - MIN_MATCH;
+		if ((size_t) (op - dst) + sequence_size (lit, mlen, true) > dst_max)
+			return 0;
+		op = put_sequence (op, anchor, lit, ip - ref, mlen);
+		ip = anchor = mp;
+	}
+
+	lit = end - anchor;
+	if ((size_t) (op - dst) + sequence_size (lit, 0, false) > dst_max)
+		return 0;
+	op = put_sequence (op, anchor, lit, 0, 0);
+	return op - dst;
+}
+
+/* Reads extra length bytes from *IP, which must stay below END, and
+ * returns their sum, or SIZE_MAX if the input is truncated. */
+static size_t
+get_len (const uint8_t **ip, const uint8_t *end) {
+	size_t len = 0;
+	uint8_t b;
+
+	do {
+		if (*ip >= end)
+			return SIZE_MAX;
+		b = *(*ip)++;
+		len += b;
+	} while (b == 255);
+	return len;
+}
+
+/* Decompresses SRC_LEN bytes at SRC into exactly DST_LEN bytes at
+ * DST.  Returns false if the input is malformed. */
+static bool
+lz_decompress (const uint8_t *src, size_t src_len, uint8_t *dst,
+		size_t dst_len) {
+	const uint8_t *ip = src, *ip_end = src + src_len;
+	uint8_t *op = dst, *op_end = dst + dst_len;
+
+	for (;;) {
+		size_t lit, offset, mlen, extra;
+		unsigned token;
+
+		if (ip >= ip_end)
+			return false;
+		token = *ip++;
+
+		lit = token >> 4;
+		if (lit == 15) {
+			extra = get_len (&ip, ip_end);
+			if (extra == SIZE_MAX)
+				return false;
+			lit += extra;
+		}
+		if (lit > (size_t) (ip_end - ip) || lit > (size_t) (op_end - op))
+			return false;
+		memcpy (op, ip, lit);
+		op += lit;
+		ip += lit;
+		if (ip == ip_end)
+			return op == op_end;
+
+		if (ip_end - ip < 2)
+			return false;
+		offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		mlen = token & 15;
+		if (mlen == 15) {
+			extra = get_len (&ip, ip_end);
+			if (extra == SIZE_MAX)
+				return false;
+			mlen += extra;
+		}
+		mlen += MIN_MATCH;
+		if (offset == 0 || offset > (size_t) (op - dst)
+				|| mlen > (size_t) (op_end - op))
+			return false;
+
+		/* Copy a byte at a time: the match may overlap its own
+		 * output, which is how runs are encoded. */
+		for (; mlen > 0; mlen--, op++)
+			*op = op[-offset];
+	}
+}